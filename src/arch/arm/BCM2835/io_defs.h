@@ -15,18 +15,25 @@
  * We want to protect 6 different I/O control registers in the target system, starting from physical address 0x20200000,
  * for both pin multiplexing and pin configuration. Each register is 32-bit wide, having
  * 3 bits for each I/O pin, for a total of 10 pins managed by each register.
+ * These registers are checked on each scan period (critical tier).
+ *
+ * Secondary control registers are protected as well, but they are checked less often (secondary tier):
+ *   - Event detect registers (GPREN, GPFEN, GPHEN, GPLEN, GPAREN, GPAFEN), two for each type,
+ *     one bit for each pin, each pair followed by a reserved word.
+ *   - Pull-up/down registers (GPPUD, GPPUDCLK0, GPPUDCLK1), used to clock a new pull state into the pins.
  */
-#define IO_BLOCKS            	1 // Registers are contiguous, only one block needed
 #define PINS_PER_REG         	10
 
-// Block 1
-#define PIN_CTRL_BASE        	((void*)0x20200000) // Pin controller start address
-#define PIN_CTRL_SIZE        	24 // 6 regs * 4 bytes each
-
-// Other blocks here...
-// #define ...
-
-#define __IO_STATE_TOTAL_SIZE	24 // Total size of I/O memory to monitor in bytes
+/*
+ * Blocks, registers to check into each block (see io_conf.h) and the phys_io_conf object
+ * are generated from io_regs.desc (see tools/gen_io.py), together with the scan routines of io_impl.h:
+ *   - PIN_CTRL_BASE, PIN_CTRL_SIZE: pin multiplexing and configuration (GPFSEL0 - GPFSEL5)
+ *   - EVENT_CTRL_BASE, EVENT_CTRL_SIZE: event detect and pull-up/down (GPREN0 - GPPUDCLK1)
+ * Pin multiplexing and configuration bits share the same registers: they are verifiable,
+ * and classify_io_change() tells the two cases apart. Reserved bits are out of the care masks,
+ * and reserved words between event detect registers are not declared.
+ */
+#include "io_gen_defs.h"
 
 /*
  * Pin modes:       _
@@ -45,6 +52,9 @@
 #define PIN_MUX_MASK(p)      	(__PIN_MUX_MASK << (p * CTRL_BITS_PER_PIN))
 #define PIN_CONF_MASK(p)     	(__PIN_CONF_MASK << (p * CTRL_BITS_PER_PIN))
 
+// Control bits of all the pins in a register (bits 30-31 are reserved)
+#define REG_CTRL_MASK        	((1 << (PINS_PER_REG * CTRL_BITS_PER_PIN)) - 1)
+
 /*
  * Registers needed for checking the actual operation of PLC runtime.
  * We have 3 types of registers in BCM2835:
@@ -97,24 +107,4 @@ static const unsigned set_regs[REG_NUM] = {
 #define CLR_REG(pin)	(clr_regs[PIN_INDEX(pin)])
 #define SET_REG(pin)	(set_regs[PIN_INDEX(pin)])
 
-
-static const void* bcm2835_io_addrs[IO_BLOCKS] = {
-	PIN_CTRL_BASE
-};
-
-static const unsigned bcm2835_io_sizes[IO_BLOCKS] = {
-	PIN_CTRL_SIZE
-};
-
-// Fill in the required global struct.
-static const io_conf_t phys_io_conf = {
-	.addrs = bcm2835_io_addrs,
-	.sizes = bcm2835_io_sizes,
-	.blocks = IO_BLOCKS,
-	.size = __IO_STATE_TOTAL_SIZE
-};
-
-
-#define IO_BLOCK_SIZE(b) (phys_io_conf.sizes[b] / sizeof(u32))
-
 #endif
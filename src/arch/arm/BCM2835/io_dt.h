@@ -0,0 +1,15 @@
+#ifndef __IO_DT_H
+#define __IO_DT_H
+
+/*
+ * BCM2835 pin controller in the device tree (see io_discovery.h).
+ *
+ * The same GPIO controller is used by BCM2836 and BCM2837, with the peripherals at 0x3F000000
+ * instead of 0x20000000: the blocks of io_defs.h are rebased on the address of the node.
+ * The node is 0xB4 bytes long, the blocks end with GPPUDCLK1.
+ */
+#define IO_DT_COMPATIBLE	"brcm,bcm2835-gpio"
+#define IO_DT_BASE      	0x20200000 // PIN_CTRL_BASE
+#define IO_DT_SPAN      	0xA0 // Up to GPPUDCLK1 (0x9C) included
+
+#endif
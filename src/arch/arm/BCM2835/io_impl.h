@@ -2,16 +2,23 @@
 #define __IO_IMPL_H
 
 #include <asm/io.h>
+#include <linux/completion.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
 #include <linux/delay.h>
+#include <linux/sched.h>
 
+#include "log.h"
 #include "io_defs.h"
 #include "dr_monitor.h"
+#include "events.h"
 
 /*
  * We monitor pin configuration and pin multiplexing registers (which are the same registers in BCM2835).
- * Here, for simplicity, other configuration registers are ignored, but they could be protected as well
- * by defining an expected behaviour and detecting changes that do not follow this behaviour.
- * We do this only for pin multiplexing and pin configuration registers, as follows.
+ * Secondary control registers (event detect and pull-up/down) are monitored as well, with a lower rate (see io_defs.h).
+ * The PLC runtime does not use them, so any change to them is considered Pin Control Attack. Note that the pull state
+ * itself cannot be read back on BCM2835: restoring pull-up/down registers only stops the clocking of a new pull state.
+ * For pin multiplexing and pin configuration registers we define an expected behaviour instead, as follows.
  *
  * For pin multiplexing, the monitor verifies that the I/O configuration never changes. If such a change occurs, then the
  * monitor consider this case as a Pin Control Attack attempt. This is a fair assumption, because it supposes that the physical
@@ -32,58 +39,161 @@
  *   2) A Pin Configuration register has been changed, and it is not conforming with actual operation performed by the PLC logic.
  */
 
+typedef struct {
+	unsigned policy; // Policy class of the register
+	unsigned pin; // Global pin number (of the first detected pin, for batches)
+	unsigned reg_pin; // Pin offset into control register
+	u32 diff; // Changed control bits (of all the pins, for batches)
+	u32 legit; // Changed control bits judged legitimate
+	u32* trusted; // Trusted value, into the scan plan
+	u32* pending; // Bits of the register under verification, into the scan plan
+} target_info_t;
+#define __IO_TARGET_INFO_SIZE	sizeof(target_info_t)
+
 /*
- * Our target platform has all 32-bit wide registers, we can use u32 for every read/write.
+ * Change handlers of the generated scan routines (see io_gen.h).
+ * Changes are detected at the word level: the whole register is compared with its trusted value first,
+ * so that an unchanged register (the normal case) costs a single XOR and branch.
+ * Immutable registers (event detect, pull-up/down) produce one detection for the whole register.
+ * For verifiable registers (pin multiplexing and configuration), the changed pins are walked by finding
+ * the lowest set bit (count trailing zeros), and clearing all the control bits of the corresponding pin
+ * before looking for the next one.
  */
+static io_detect_t info; // Static detection information: the monitor copies it if needed.
+static target_info_t tinfo;
 
-static inline void get_io_state(volatile void** addrs, void* state) {
-	u32* u32_state = (u32*)state;
-	volatile u32** u32_addrs = (volatile u32**)addrs;
-	unsigned b, w;
+static inline void __fill_io_detect(io_scan_t* e, u32 value) {
+	info.target = (void*)e->addr;
+	info.new_val = value;
+	info.old_val = e->trusted;
+	info.target_info = (void*)&tinfo;
+	tinfo.policy = e->policy;
+	tinfo.trusted = &e->trusted;
+	tinfo.pending = &e->pending;
+}
 
-	for (b = 0; b < phys_io_conf.blocks; b++) { // For each block
-		for (w = 0; w < IO_BLOCK_SIZE(b); w++) { // For each word in block
-			*(u32_state++) = ioread32(u32_addrs[b] + w);
-		}
-	}
+static inline void check_immutable_change(io_scan_t* e, u32 value, u32 diff) {
+	__fill_io_detect(e, value);
+	tinfo.pin = tinfo.reg_pin = 0;
+	tinfo.diff = diff;
+	tinfo.legit = 0;
+	handle_io_detection(&info);
 }
 
-typedef struct {
-	unsigned pin; // Global pin number
-	unsigned reg_pin; // Pin offset into control register
-	u32 diff;
-	u32* trusted;
-} target_info_t;
-static io_detect_t info; // Static detection information: detections are handled sequentially.
-static target_info_t tinfo;
-static inline void check_io_state(volatile void* block, const void* state, unsigned index) {
-	u32* current_val = (u32*)block;
-	u32* trusted_val = (u32*)state;
-	u32* limit;
-	u32 value;
-	unsigned reg_pin, pin = 0;
-	u32 diff;
-
-	for (	limit = current_val + IO_BLOCK_SIZE(index);
-		current_val < limit;
-		current_val++, trusted_val++	) { // For each register
-		
-		value = ioread32(current_val);
-		for (reg_pin = 0; reg_pin < PINS_PER_REG; reg_pin++, pin++) { // For each pin in register
-			diff = (value ^ (*trusted_val)) & PIN_CTRL_MASK(reg_pin);
-			if (diff) {
-				info.target = (void*)current_val;
-				info.new_val = value;
-				info.old_val = *trusted_val;
-				tinfo.pin = pin;
-				tinfo.reg_pin = reg_pin;
-				tinfo.diff = diff;
-				tinfo.trusted = trusted_val;
-				info.target_info = (void*)&tinfo;
-				handle_io_detection(&info);
-			}
-		}
+static inline void check_verifiable_change(io_scan_t* e, u32 value, u32 diff, unsigned first_pin) {
+	unsigned reg_pin;
+
+	__fill_io_detect(e, value);
+	do { // For each changed pin in register
+		reg_pin = __ffs(diff) / CTRL_BITS_PER_PIN;
+		tinfo.pin = first_pin + reg_pin;
+		tinfo.reg_pin = reg_pin;
+		tinfo.diff = diff & PIN_CTRL_MASK(reg_pin);
+		tinfo.legit = 0;
+		handle_io_detection(&info);
+		diff &= ~PIN_CTRL_MASK(reg_pin);
+	} while (diff);
+}
+
+/*
+ * get_io_state() and check_io_state(), unrolled for the registers of io_regs.desc.
+ */
+#include "io_gen.h"
+
+/*
+ * Learned profile of the PLC logic: runtime direction of each pin, one bit for each pin
+ * of the SET/LEV registers (see learn_io_step below).
+ *  - Output pins: pins written by the logic through SET or CLR registers, unless configured as input
+ *    and read as well (see end_io_learning).
+ *  - Input pins: pins configured as input, never written, of LEV registers read by the logic.
+ *    A read gets the whole register, so a pin is profiled as input only if its register is actually read.
+ * A pin configuration change conforming to the profile is legitimate, otherwise it is Pin Control Attack.
+ * Pins which are not in the profile are verified by watchpoints, as usual: legitimate verdicts are
+ * recorded into the profile as well. A profiled pin never changes direction until the next learning phase,
+ * so the learning phase must be run again after a PLC logic upload.
+ */
+static u32 learned_out[REG_NUM];
+static u32 learned_in[REG_NUM];
+static int learned; // Profile available
+
+// Constant time verdict for a pin configuration change, UNDECIDED if the pin is not profiled
+static inline int profiled_verdict(unsigned pin, int output) {
+	u32 bit = 1 << PIN_SHIFT(pin);
+
+	if (!READ_ONCE(learned)) return UNDECIDED;
+	smp_rmb();
+	if (learned_out[PIN_INDEX(pin)] & bit) return output ? LEGITIMATE : NOT_LEGITIMATE;
+	if (learned_in[PIN_INDEX(pin)] & bit) return output ? NOT_LEGITIMATE : LEGITIMATE;
+	return UNDECIDED;
+}
+
+// It is pin multiplexing if either pin mux bits are modified or
+// at least one of pin mux bits is not 0 and pin conf bit is modified
+#define is_pin_mux(info, tinfo)	(((tinfo)->diff & PIN_MUX_MASK((tinfo)->reg_pin)) || \
+                               	 ((info)->old_val & PIN_MUX_MASK((tinfo)->reg_pin)))
+
+static inline int classify_io_change(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	int verdict;
+
+	// Secondary registers are not used by the PLC runtime
+	if (tinfo->policy == IO_IMMUTABLE) return NOT_LEGITIMATE;
+
+	if (is_pin_mux(info, tinfo)) {
+		// Pin Multiplexing is never legitimate
+		return NOT_LEGITIMATE;
 	}
+
+	// Pin Configuration: check the profile first, otherwise the PLC logic must be observed (see is_legitimate)
+	verdict = profiled_verdict(tinfo->pin, info->new_val & PIN_CONF_MASK(tinfo->reg_pin));
+	if (verdict == LEGITIMATE) tinfo->legit = tinfo->diff;
+	return verdict;
+}
+
+// The mode of a pin is its function select value (000 input, 001 output)
+static inline int io_change_intent(io_detect_t* info, unsigned* pin, unsigned* mode) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+
+	if (tinfo->policy == IO_IMMUTABLE || is_pin_mux(info, tinfo)) return 0;
+	*pin = tinfo->pin;
+	*mode = (info->new_val & PIN_CTRL_MASK(tinfo->reg_pin)) >> (tinfo->reg_pin * CTRL_BITS_PER_PIN);
+	return 1;
+}
+
+static inline void accept_io_change(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	tinfo->legit = tinfo->diff;
+}
+
+/*
+ * Pins of the same control register, configured in the same direction, are verified through the same
+ * SET (input) or LEV (output) register, so they share a watchpoint and an observation window.
+ * Since a control register holds 10 pins and SET/LEV registers hold 32 pins, the pins of a batch
+ * always belong to the same SET/LEV register as well, except for the register holding pins 30-39:
+ * the SET/LEV register is part of the key, in the (unused) lowest bits of the control register address.
+ * The direction of a batch is the one of its first pin: @new_val is not updated by merges.
+ */
+static inline unsigned long io_verify_key(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	unsigned output = !!(info->new_val & PIN_CONF_MASK(tinfo->reg_pin));
+	return (unsigned long)info->target | (output << 1) | PIN_INDEX(tinfo->pin);
+}
+
+static inline void merge_io_change(io_detect_t* batch, io_detect_t* info) {
+	target_info_t* btinfo = (target_info_t*)batch->target_info;
+	btinfo->diff |= ((target_info_t*)info->target_info)->diff;
+}
+
+// Only the pin configuration bit is masked: the pin multiplexing bits
+// of a pin under verification are still checked on each scan.
+static inline void mark_io_pending(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	*(tinfo->pending) |= tinfo->diff;
+}
+
+static inline void clear_io_pending(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	*(tinfo->pending) &= ~tinfo->diff;
 }
 
 
@@ -98,32 +208,93 @@ static inline void check_io_state(volatile void* block, const void* state, unsig
  *
  */
 
-static void* volatile hw_break = NULL;
-static DEFINE_MUTEX(dr_lock);
-#define atomic_reset_dr(dr) do {	\
-	mutex_lock(&dr_lock);   	\
-	if (dr) reset_dr(dr);   	\
-	dr = NULL;              	\
-	mutex_unlock(&dr_lock); 	\
-} while (0)
+// State of a single verification, given to the watchpoint handlers as context.
+// Verifications of different registers may run concurrently, each one with its own watchpoint.
+typedef struct {
+	void* hw_break; // Watchpoint
+	volatile u32 watched; // SET/LEV bits of the pins under verification
+	volatile u32 illegal; // SET/LEV bits of the pins judged not legitimate
+	int tgid; // PLC runtime, the only process whose accesses are evidence of legitimacy
+	unsigned accesses; // Accesses of the PLC logic observed so far
+	u64 last; // Time of the last access (ns)
+	struct completion done; // Enough evidence collected
+} io_watch_t;
 
-static volatile int legitimate = LEGITIMATE; // Default state
-static volatile unsigned pin;
+#define watch_of(bp)	((io_watch_t*)(bp)->overflow_handler_context)
+
+/*
+ * Verification window.
+ * The window closes as soon as there is enough evidence about the pins under verification:
+ *  - a verdict for each pin (i.e. all of them have been misused);
+ *  - 'verify_accesses' accesses of the PLC logic to the watched register, none of them misusing the pins;
+ *  - 'verify_periods' scan periods of the PLC logic, once the period has been learned.
+ * The scan period is learned from the time between consecutive writes observed on SET registers
+ * (moving average over all the verifications). The fixed waits below are only upper bounds,
+ * for logics which do not access the registers on each scan cycle.
+ * Setting a parameter to 0 disables the corresponding criterion.
+ *
+ * Watchpoints are wide (not bound to the PLC runtime), so they fire on any process accessing the same virtual address:
+ * only the accesses of the PLC runtime are counted and sampled, otherwise any process could close a window early.
+ * Accesses of other processes can still misuse a pin (a false positive is safe, a false negative is not).
+ * Writes closer than MIN_SCAN_PERIOD belong to the same scan cycle, so they are not period samples:
+ * a burst of writes cannot shrink the window.
+ */
+static unsigned verify_accesses = 8;
+static unsigned verify_periods = 4;
+static u64 scan_period; // Learned scan period of the PLC logic (ns)
+#define MIN_SCAN_PERIOD	NSEC_PER_MSEC // Shortest scan cycle of a PLC logic (ns)
+module_param(verify_accesses, uint, 0644);
+MODULE_PARM_DESC(verify_accesses, "Accesses of the PLC logic needed to close a pin verification (0 disables)");
+module_param(verify_periods, uint, 0644);
+MODULE_PARM_DESC(verify_periods, "Learned scan periods of the PLC logic needed to close a pin verification (0 disables)");
+
+static inline void learn_scan_period(u64 sample) {
+	u64 period = READ_ONCE(scan_period);
+
+	if (sample < MIN_SCAN_PERIOD) return;
+	WRITE_ONCE(scan_period, period ? period - (period >> 3) + (sample >> 3) : sample);
+}
+
+// Window in jiffies, given its upper bound in milliseconds
+static inline unsigned long verify_window(unsigned max_ms) {
+	u64 window = (u64)max_ms * NSEC_PER_MSEC;
+	u64 periods = READ_ONCE(scan_period) * READ_ONCE(verify_periods);
+
+	if (periods && periods < window) window = periods;
+	return usecs_to_jiffies(div_u64(window, NSEC_PER_USEC));
+}
+
+// Any access of the PLC logic to the watched register
+static inline void count_access(io_watch_t* w) {
+	unsigned accesses = READ_ONCE(verify_accesses);
+	if (++w->accesses == accesses) complete(&w->done);
+}
 
 // The logic in Raspberry Pi BCM2835 writes outputs only when the value must change.
 // This is not the nomal behaviour for PLCs, which should write for each scan cycle (each 10ms).
 // Thus, for this implementation we have to wait for a very long time (4 secs according to the logic).
-// For a typical PLC a wait of 20ms would be enough.
+// For a typical PLC a wait of 20ms would be enough, and the window closes earlier (see above).
 #define WAIT_FOR_LOGIC_W	4500
 static void dr_write_handler(struct perf_event *bp, struct perf_sample_data *data, struct pt_regs *regs) {
 	// Write instruction of PLC runtime:
 	//  - STR R2, [R3] (Opcode 002083e5)
-	// If R2 contains a 1 corresponding to current pin, it means that PLC logic is trying
+	// If R2 contains a 1 corresponding to a watched pin, it means that PLC logic is trying
 	// to write to the pin while it's in input mode: Pin Control Attack.
-	if (regs->ARM_r2 & (1 << PIN_SHIFT(pin))) {
-		legitimate = NOT_LEGITIMATE;
-		atomic_reset_dr(hw_break); // Remove watchpoint
+	// The other pins of the batch are still watched, until each of them has a verdict.
+	io_watch_t* w = watch_of(bp);
+	u32 bad = regs->ARM_r2 & w->watched;
+	u64 now;
+
+	if (bad & ~w->illegal) {
+		w->illegal |= bad;
+		if (w->illegal == w->watched) complete(&w->done); // Every pin judged
 	}
+
+	if (task_tgid_nr(current) != w->tgid) return; // Not evidence of legitimacy
+	now = local_clock();
+	if (w->last) learn_scan_period(now - w->last);
+	w->last = now;
+	count_access(w);
 }
 
 #define WAIT_FOR_LOGIC_R	15
@@ -132,9 +303,11 @@ static void dr_read_handler(struct perf_event *bp, struct perf_sample_data *data
 	//  - LDR	R2, [R3] (00 20 93 E5)
 	// Here we are not able to say in which pin the PLC logic is interested (which pins are
 	// really considered input), because the register includes 32 pins. Therefore, we assume that
-	// PLC logic may have only one input on the watched register, so any read here means Pin Control Attack.
-	legitimate = NOT_LEGITIMATE;
-	atomic_reset_dr(hw_break); // Remove watchpoint
+	// PLC logic may have only one input on the watched register, so any read here means Pin Control Attack,
+	// for all the pins of the batch.
+	io_watch_t* w = watch_of(bp);
+	w->illegal = w->watched;
+	complete(&w->done); // Every pin judged
 }
 
 /*
@@ -147,8 +320,8 @@ static void dr_read_handler(struct perf_event *bp, struct perf_sample_data *data
  *
  * So we put a second read watchpoint on that address (FP - 0x14) and analysed the code again:
  *
- * reset_dr(hw_break);
- * hw_break = set_read_dr(0, (void*)(*(unsigned*)(regs->ARM_fp - 0x14)), dr_further_handler);
+ * reset_dr(w->hw_break);
+ * w->hw_break = set_read_dr(0, (void*)(*(unsigned*)(regs->ARM_fp - 0x14)), dr_further_handler, w);
  *
  * static void dr_further_handler(struct perf_event *bp, struct perf_sample_data *data, struct pt_regs *regs) {
  * 	// Instructions of PLC runtime which generates this handler:
@@ -166,49 +339,194 @@ static void dr_read_handler(struct perf_event *bp, struct perf_sample_data *data
  * }
  */
 
+/*
+ * Learning phase: one step for each SET, CLR and LEV register, each one observed through its own watchpoint
+ * for 'learn_time' milliseconds. Steps run concurrently, up to the number of watchpoints.
+ * The handlers only accumulate what they see (pins written, or register read), the profile is built at the end.
+ * As for verifications, the logic in Raspberry Pi BCM2835 writes outputs only when the value must change,
+ * so the default observation is as long as a write verification.
+ * Learning watchpoints are wide as well: only the accesses of the PLC runtime are accumulated (see verify_accesses),
+ * otherwise any process could poison the profile.
+ */
+static const unsigned* const learn_regs[] = { set_regs, clr_regs, lev_regs };
+#define LEARN_LEV        	2 // Index of LEV registers into learn_regs
+#define __IO_LEARN_STEPS	(ARRAY_SIZE(learn_regs) * REG_NUM)
+
+static unsigned learn_time = WAIT_FOR_LOGIC_W;
+module_param(learn_time, uint, 0644);
+MODULE_PARM_DESC(learn_time, "Time in milliseconds to observe each SET/CLR/LEV register while learning the PLC logic");
+
+static u32 learn_seen[__IO_LEARN_STEPS]; // Pins written (SET/CLR), or ~0 if read (LEV)
+static int learn_lost[__IO_LEARN_STEPS]; // Steps without a watchpoint
+static int learn_tgid; // PLC runtime
+
+static void learn_write_handler(struct perf_event *bp, struct perf_sample_data *data, struct pt_regs *regs) {
+	if (task_tgid_nr(current) != READ_ONCE(learn_tgid)) return;
+	*(u32*)bp->overflow_handler_context |= regs->ARM_r2; // STR R2, [R3] (see dr_write_handler)
+}
+
+static void learn_read_handler(struct perf_event *bp, struct perf_sample_data *data, struct pt_regs *regs) {
+	if (task_tgid_nr(current) != READ_ONCE(learn_tgid)) return;
+	*(u32*)bp->overflow_handler_context = ~0;
+}
+
+static inline void begin_io_learning(void) {
+	WRITE_ONCE(learned, 0);
+	memset(learn_seen, 0, sizeof(learn_seen));
+	memset(learn_lost, 0, sizeof(learn_lost));
+}
+
+static inline void learn_io_step(unsigned step, int pid, void* vaddr) {
+	unsigned type = step / REG_NUM, i = step % REG_NUM;
+	void* dr;
+
+	WRITE_ONCE(learn_tgid, pid); // Same for all the steps
+	pid = 0; // PID not supported for now
+
+	vaddr += learn_regs[type][i];
+	if (type == LEARN_LEV) dr = set_read_dr(pid, vaddr, learn_read_handler, &learn_seen[step]);
+	else dr = set_write_dr(pid, vaddr, learn_write_handler, &learn_seen[step]);
+	if (!dr) {
+		learn_lost[step] = 1;
+		return;
+	}
+	msleep(READ_ONCE(learn_time));
+	reset_dr(dr);
+}
+
+// Pins of a SET/LEV register configured as input in the given state
+static inline u32 input_pins(const u32* state, unsigned index) {
+	unsigned pin, last = min(32 * (index + 1), (unsigned)(PIN_CTRL_SIZE / sizeof(u32) * PINS_PER_REG));
+	u32 pins = 0;
+
+	for (pin = 32 * index; pin < last; pin++) {
+		if (!(state[pin / PINS_PER_REG] & PIN_CTRL_MASK(pin % PINS_PER_REG)))
+			pins |= 1 << PIN_SHIFT(pin);
+	}
+	return pins;
+}
+
+#define learn_step(type, i)	((type) * REG_NUM + (i))
+
+// Input pins of a register read by the logic, but written as well, are left out of the profile:
+// their direction is ambiguous, so their changes are still verified by watchpoints.
+static inline void end_io_learning(const void* state) {
+	unsigned i;
+	u32 written, read;
+
+	for (i = 0; i < REG_NUM; i++) {
+		learned_out[i] = learned_in[i] = 0;
+		if (learn_lost[learn_step(0, i)] || learn_lost[learn_step(1, i)] || learn_lost[learn_step(LEARN_LEV, i)])
+			continue; // Pins of this register not profiled
+		written = learn_seen[learn_step(0, i)] | learn_seen[learn_step(1, i)];
+		read = learn_seen[learn_step(LEARN_LEV, i)] & input_pins((const u32*)state, i);
+		learned_out[i] = written & ~read;
+		learned_in[i] = read & ~written;
+		log_event("Learned pins of SET/LEV register %u: outputs 0x%08x, inputs 0x%08x\n", i, learned_out[i], learned_in[i]);
+	}
+	smp_wmb();
+	WRITE_ONCE(learned, 1);
+}
+
+// Only pin configuration changes get here (see classify_io_change), batched by io_verify_key().
+// Verifications may run concurrently, up to the number of watchpoints (see watch_dr_slots).
+// If a watchpoint cannot be set, the batch cannot be verified: it is considered not legitimate.
+// Pins profiled in the meantime (e.g. by a learning phase after a logic upload) do not need a watchpoint.
 static inline int is_legitimate(io_detect_t* info, int pid, void* vaddr) {
 	target_info_t* tinfo = (target_info_t*)info->target_info;
+	unsigned first_pin = tinfo->pin - tinfo->reg_pin, reg_pin, pin;
+	int output = info->new_val & PIN_CONF_MASK(tinfo->reg_pin);
+	io_watch_t w;
+	u32 diff, bit, watched = 0, illegal = 0;
+	u64 start = local_clock();
 
+	w.tgid = pid;
 	pid = 0; // PID not supported for now
 
-	// It is pin multiplexing if either pin mux bits are modified or
-	// at least one of pin mux bits is not 0 and pin conf bit is modified
-	if ( (tinfo->diff & PIN_MUX_MASK(tinfo->reg_pin)) ||
-	     (info->old_val & PIN_MUX_MASK(tinfo->reg_pin)) ) {
-		// Pin Multiplexing is never legitimate
-		return NOT_LEGITIMATE;
-	} else {
+	// SET/LEV bits of all the pins in the batch: profiled pins are judged immediately,
+	// the others by observing the PLC logic
+	for (diff = tinfo->diff; diff; diff &= ~PIN_CTRL_MASK(reg_pin)) {
+		reg_pin = __ffs(diff) / CTRL_BITS_PER_PIN;
+		pin = first_pin + reg_pin;
+		bit = 1 << PIN_SHIFT(pin);
+		switch (profiled_verdict(pin, output)) {
+		case UNDECIDED:
+			watched |= bit;
+			break;
+		case NOT_LEGITIMATE:
+			illegal |= bit;
+			break;
+		}
+	}
+
+	if (watched) {
+		w.illegal = 0;
+		w.watched = watched;
+		w.accesses = 0;
+		w.last = 0;
+		init_completion(&w.done);
+
 		// Pin Configuration: check if PLC logic is conforming with configuration
-		if (info->new_val & PIN_CONF_MASK(tinfo->reg_pin)) {
+		if (output) {
 			// Output, operation should be WRITE
-			// If read watchpoint is triggered at least once on this pin,
+			// If read watchpoint is triggered at least once on these pins,
 			// then it is Pin Control Attack.
-			pin = tinfo->pin; // Save global pin number for watchpoint
-			hw_break = set_read_dr(pid, vaddr + LEV_REG(pin), dr_read_handler);
-			msleep(WAIT_FOR_LOGIC_R);
+			w.hw_break = set_read_dr(pid, vaddr + LEV_REG(tinfo->pin), dr_read_handler, &w);
+			if (w.hw_break) wait_for_completion_timeout(&w.done, verify_window(WAIT_FOR_LOGIC_R));
+			else w.illegal = watched;
 		} else {
 			// Input, operation should be READ
-			// If write watchpoint is triggered at least once on this pin,
-			// then it is Pin Control Attack.
-			pin = tinfo->pin; // Save global pin number for watchpoint
-			hw_break = set_write_dr(pid, vaddr + SET_REG(pin), dr_write_handler);
-			msleep(WAIT_FOR_LOGIC_W);
+			// If write watchpoint is triggered at least once on a pin,
+			// then it is Pin Control Attack for that pin.
+			w.hw_break = set_write_dr(pid, vaddr + SET_REG(tinfo->pin), dr_write_handler, &w);
+			if (w.hw_break) wait_for_completion_timeout(&w.done, verify_window(WAIT_FOR_LOGIC_W));
+			else w.illegal = watched;
 		}
-		atomic_reset_dr(hw_break); // Remove watchpoint
-		if (legitimate) return LEGITIMATE;
-		legitimate = LEGITIMATE; // Reset flag
-		return NOT_LEGITIMATE;
+		reset_dr(w.hw_break); // Remove watchpoint
+		log_event("Verification closed after %u accesses in %lu ms\n", w.accesses, (unsigned long)div_u64(local_clock() - start, NSEC_PER_MSEC));
+		illegal |= w.illegal;
 	}
+
+	// One verdict for each pin
+	tinfo->legit = 0;
+	for (diff = tinfo->diff; diff; diff &= ~PIN_CTRL_MASK(reg_pin)) {
+		reg_pin = __ffs(diff) / CTRL_BITS_PER_PIN;
+		if (!(illegal & (1 << PIN_SHIFT(first_pin + reg_pin))))
+			tinfo->legit |= tinfo->diff & PIN_CTRL_MASK(reg_pin);
+	}
+	if (tinfo->legit == tinfo->diff) return LEGITIMATE;
+	return tinfo->legit ? PARTIALLY_LEGITIMATE : NOT_LEGITIMATE;
 }
 
+// Legitimate pins are recorded into the profile, with the direction of the batch.
 static inline void update_io_state(io_detect_t* info) {
 	target_info_t* tinfo = (target_info_t*)info->target_info;
-	*(tinfo->trusted) ^= tinfo->diff;
+	unsigned first_pin = tinfo->pin - tinfo->reg_pin, reg_pin;
+	u32 diff, pins = 0;
+
+	*(tinfo->trusted) ^= tinfo->legit;
+
+	if (!READ_ONCE(learned)) return;
+	for (diff = tinfo->legit; diff; diff &= ~PIN_CTRL_MASK(reg_pin)) {
+		reg_pin = __ffs(diff) / CTRL_BITS_PER_PIN;
+		pins |= 1 << PIN_SHIFT(first_pin + reg_pin);
+	}
+	if (info->new_val & PIN_CONF_MASK(tinfo->reg_pin)) {
+		learned_out[PIN_INDEX(tinfo->pin)] |= pins;
+		learned_in[PIN_INDEX(tinfo->pin)] &= ~pins;
+	} else {
+		learned_in[PIN_INDEX(tinfo->pin)] |= pins;
+		learned_out[PIN_INDEX(tinfo->pin)] &= ~pins;
+	}
 }
 
+// The register may have changed since detection: restore only the changed bits,
+// except the ones of the pins judged legitimate.
 static inline void __restore_io_state(io_detect_t* info) {
 	target_info_t* tinfo = (target_info_t*)info->target_info;
-	iowrite32(info->new_val ^ tinfo->diff, info->target);
+	u32 bits = tinfo->diff & ~tinfo->legit;
+	u32 value = ioread32(info->target);
+	iowrite32((value & ~bits) | (*(tinfo->trusted) & bits), info->target);
 }
 
 #endif
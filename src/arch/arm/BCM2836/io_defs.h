@@ -0,0 +1,15 @@
+#ifndef __BCM2836_IO_DEFS_H
+#define __BCM2836_IO_DEFS_H
+
+/*
+ * BCM2836/BCM2837 I/O Configuration registers.
+ *
+ * Broadcom 2836 and 2837 System-on-Chip used in the second and third generation of Raspberry Pi board.
+ * https://www.raspberrypi.org/documentation/hardware/raspberrypi/bcm2836/README.md
+ *
+ * The GPIO controller is the same as BCM2835 (see ../BCM2835/io_defs.h), with the peripherals at 0x3F000000:
+ * the blocks are generated from the io_regs.desc of this directory, everything else is shared.
+ */
+#include "../BCM2835/io_defs.h"
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __IO_DT_H
+#define __IO_DT_H
+
+// Same pin controller as BCM2835 (see ../BCM2835/io_dt.h), at the base of this model
+#define IO_DT_COMPATIBLE	"brcm,bcm2835-gpio"
+#define IO_DT_BASE      	0x3F200000 // PIN_CTRL_BASE
+#define IO_DT_SPAN      	0xA0 // Up to GPPUDCLK1 (0x9C) included
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __BCM2836_IO_IMPL_H
+#define __BCM2836_IO_IMPL_H
+
+/*
+ * Same I/O monitoring as BCM2835 (see ../BCM2835/io_impl.h).
+ * BCM2836 (Cortex-A7) and BCM2837 (Cortex-A53, 32-bit kernel) are quad-core: watchpoints used for verifications
+ * are set on each CPU, and the DRs of each CPU are checked by the DR monitor.
+ */
+#include "../BCM2835/io_impl.h"
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __IO_DEFS_H
+#define __IO_DEFS_H
+
+/*
+ * OMAP3/AM35xx I/O Configuration registers.
+ *
+ * Texas Instruments AM3505/AM3517 (OMAP3 family) System-on-Chip used in the WAGO PFC200 PLC (e.g. 750-8202).
+ * AM35xx Technical Reference Manual: http://www.ti.com/lit/ug/spruGR0/spruGR0.pdf
+ *
+ */
+
+/*
+ * Unlike BCM2835, pin multiplexing and pin configuration are done by different modules, at different bases:
+ *   - Pin multiplexing: pad configuration registers of the system control module (0x48002030), one 16-bit
+ *     register for each pad, two pads for each 32-bit word. The MUXMODE field selects the function of the pad
+ *     (e.g. 4 for GPIO), the other fields its pull and input buffer.
+ *   - Pin configuration: output enable register (GPIO_OE) of each of the 6 GPIO banks, 32 pins for each bank,
+ *     one bit for each pin (0 output, 1 input). Global pin number = bank * 32 + bit, as in the kernel (GPIO 97 is bank 4, bit 1).
+ * These registers are checked on each scan period (critical tier), for a total of 290 registers (592 bytes).
+ * Pads are read with 16-bit accesses, so that a change is detected, and restored, for its own pad only.
+ *
+ * Secondary control registers are protected as well, but they are checked less often (secondary tier):
+ *   - Wake-up and ETK pads.
+ *   - Event detect registers of each GPIO bank (LEVELDETECT0, LEVELDETECT1, RISINGDETECT, FALLINGDETECT).
+ *
+ * Blocks, registers to check into each block (see io_conf.h) and the phys_io_conf object
+ * are generated from io_regs.desc (see tools/gen_io.py), together with the scan routines of io_impl.h.
+ */
+#include "io_gen_defs.h"
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef __IO_IMPL_H
+#define __IO_IMPL_H
+
+#include <asm/io.h>
+
+#include "log.h"
+#include "io_defs.h"
+
+/*
+ * We monitor pad configuration registers (pin multiplexing) and GPIO output enable registers (pin configuration).
+ * Secondary control registers (wake-up and ETK pads, GPIO event detect) are monitored as well, with a lower rate (see io_defs.h).
+ *
+ * Pin multiplexing is never legitimate, as for BCM2835: every pad is immutable, including its pull and input buffer fields.
+ *
+ * Pin configuration is different from BCM2835. On the WAGO PFC200 the I/O modules are driven by the KBUS driver,
+ * in kernel space, which configures its pins once at boot: there is no PLC logic accessing the GPIO banks from user space,
+ * so there is nothing to observe through watchpoints, and no learning phase. A change of a GPIO output enable bit is
+ * legitimate only if the PLC runtime has declared it through the intent channel (see intent.h), otherwise it is
+ * Pin Control Attack. The mode of a pin is 1 for output and 0 for input.
+ *
+ * In conclusion, we detect Pin Control Attack in the following cases:
+ *   1) A pad configuration register has been changed
+ *   2) A GPIO output enable register has been changed, and the change has not been declared by the PLC runtime.
+ */
+
+typedef struct {
+	unsigned policy; // Policy class of the register
+	unsigned width; // Access width in bytes
+	unsigned pin; // Global pin number (GPIO output enable only)
+	u32 diff; // Changed bits
+	u32 legit; // Changed bits judged legitimate
+	u32* trusted; // Trusted value, into the scan plan
+	u32* pending; // Bits of the register under verification, into the scan plan
+} target_info_t;
+#define __IO_TARGET_INFO_SIZE	sizeof(target_info_t)
+
+/*
+ * Change handlers of the generated scan routines (see io_gen.h).
+ * Registers are compared with their trusted value as a whole, so that an unchanged register costs a single XOR and branch.
+ * Pads produce one detection for each pad (each 16-bit register), GPIO output enable registers one for each changed pin.
+ */
+static io_detect_t info; // Static detection information: the monitor copies it if needed.
+static target_info_t tinfo;
+
+static inline void __fill_io_detect(io_scan_t* e, u32 value) {
+	info.target = (void*)e->addr;
+	info.new_val = value;
+	info.old_val = e->trusted;
+	info.target_info = (void*)&tinfo;
+	tinfo.policy = e->policy;
+	tinfo.width = e->width;
+	tinfo.trusted = &e->trusted;
+	tinfo.pending = &e->pending;
+}
+
+static inline void check_immutable_change(io_scan_t* e, u32 value, u32 diff) {
+	__fill_io_detect(e, value);
+	tinfo.pin = 0;
+	tinfo.diff = diff;
+	tinfo.legit = 0;
+	handle_io_detection(&info);
+}
+
+static inline void check_verifiable_change(io_scan_t* e, u32 value, u32 diff, unsigned first_pin) {
+	u32 bit;
+
+	__fill_io_detect(e, value);
+	do { // For each changed pin in register
+		bit = diff & -diff;
+		tinfo.pin = first_pin + __ffs(diff);
+		tinfo.diff = bit;
+		tinfo.legit = 0;
+		handle_io_detection(&info);
+		diff &= ~bit;
+	} while (diff);
+}
+
+/*
+ * get_io_state() and check_io_state(), unrolled for the registers of io_regs.desc:
+ * 16-bit reads for the pads, 32-bit reads for the GPIO banks.
+ */
+#include "io_gen.h"
+
+// Changes which are not declared cannot be verified (see above)
+static inline int classify_io_change(io_detect_t* info) {
+	return NOT_LEGITIMATE;
+}
+
+static inline int io_change_intent(io_detect_t* info, unsigned* pin, unsigned* mode) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+
+	if (tinfo->policy == IO_IMMUTABLE) return 0;
+	*pin = tinfo->pin;
+	*mode = !(info->new_val & tinfo->diff); // Output enable is active low
+	return 1;
+}
+
+static inline void accept_io_change(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	tinfo->legit = tinfo->diff;
+}
+
+// Never UNDECIDED: there are no batches to verify
+static inline unsigned long io_verify_key(io_detect_t* info) {
+	return (unsigned long)info->target;
+}
+
+static inline void merge_io_change(io_detect_t* batch, io_detect_t* info) {
+	target_info_t* btinfo = (target_info_t*)batch->target_info;
+	btinfo->diff |= ((target_info_t*)info->target_info)->diff;
+}
+
+static inline void mark_io_pending(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	*(tinfo->pending) |= tinfo->diff;
+}
+
+static inline void clear_io_pending(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	*(tinfo->pending) &= ~tinfo->diff;
+}
+
+static inline int is_legitimate(io_detect_t* info, int pid, void* vaddr) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	tinfo->legit = 0;
+	return NOT_LEGITIMATE;
+}
+
+// Learning mode is not supported: there is no PLC logic to observe
+#define __IO_LEARN_STEPS	0
+static inline void begin_io_learning(void) {}
+static inline void learn_io_step(unsigned step, int pid, void* vaddr) {}
+static inline void end_io_learning(const void* state) {}
+
+static inline void update_io_state(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	*(tinfo->trusted) ^= tinfo->legit;
+}
+
+// The register may have changed since detection: restore only the changed bits,
+// except the ones judged legitimate, with the access width of the register.
+static inline void __restore_io_state(io_detect_t* info) {
+	target_info_t* tinfo = (target_info_t*)info->target_info;
+	u32 bits = tinfo->diff & ~tinfo->legit;
+	u32 value;
+
+	if (tinfo->width == sizeof(u16)) {
+		value = ioread16(info->target);
+		iowrite16((value & ~bits) | (*(tinfo->trusted) & bits), info->target);
+	} else {
+		value = ioread32(info->target);
+		iowrite32((value & ~bits) | (*(tinfo->trusted) & bits), info->target);
+	}
+}
+
+#endif
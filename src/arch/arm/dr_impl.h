@@ -5,18 +5,17 @@
 #include <asm/hw_breakpoint.h>
 #include <linux/kallsyms.h>
 
-#include <asm/patch.h>
-
 #include "log.h"
 
 /*
- * Broadcom 2835 System-on-Chip used in the first generation of Raspberry Pi board.
- * https://www.raspberrypi.org/documentation/hardware/raspberrypi/bcm2835/README.md
- *
- * BCM2835 Datasheet: https://www.raspberrypi.org/wp-content/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
+ * Debug registers of ARM processors, shared by the supported SoC models.
+ * The watchpoint registers are accessed through the CP14 interface, with the same encoding on ARMv6 and ARMv7 debug:
  *
- * BCM2835 is based on an ARMv6 architecture, containing an ARM1176JZF-S processor.
+ * BCM2835 (first generation of Raspberry Pi board) is based on an ARMv6 architecture, containing an ARM1176JZF-S processor.
  * ARM1176JZF-S Technical Reference Manual: http://infocenter.arm.com/help/topic/com.arm.doc.ddi0301h/DDI0301H_arm1176jzfs_r0p7_trm.pdf
+ *
+ * OMAP3/AM35xx (WAGO PFC200 PLC) is based on an ARMv7-A architecture, containing a Cortex-A8 processor.
+ * Cortex-A8 Technical Reference Manual: http://infocenter.arm.com/help/topic/com.arm.doc.ddi0344k/DDI0344K_cortex_a8_r3p2_trm.pdf
  */
 
 
@@ -130,6 +129,44 @@ static inline unsigned count_drs(void) {
 	return dr_slots;
 }
 
+static inline unsigned count_watch_drs(void) {
+	return wp_slots;
+}
+
+// The event info (address and control register value) is built by the architecture code
+// when an event is registered. There is no interface to modify a wide DR, and modify_user_hw_breakpoint()
+// is disabled by this monitor, so the same validation function is called directly.
+static int (*validate_dr)(struct perf_event*) = NULL;
+static inline int can_retarget_dr(void) {
+	if (!validate_dr) {
+		validate_dr = (int (*)(struct perf_event*))kallsyms_lookup_name("arch_validate_hwbkpt_settings");
+	}
+	return validate_dr != NULL;
+}
+
+static inline int __retarget_dr(struct perf_event* bp, void* vaddr, unsigned type) {
+	bp->attr.bp_addr = (unsigned long)vaddr;
+	bp->attr.bp_type = type;
+	return validate_dr(bp);
+}
+
+// When a watchpoint is uninstalled only its control register is cleared,
+// so its value register still holds the target address.
+static inline void update_dr_slot(void* state, void* vaddr) {
+	u32* u32_state = (u32*)state + bp_slots * __DR_U32_STATE_SIZE;
+	u32 value = 0;
+	unsigned i;
+
+	for (i = 0; i < wp_slots; i++) {
+		READ_WB_REG(ARM_OP2_WVR, i, value); // Read watchpoint value register
+		if (value == ((unsigned long)vaddr & ~0x3)) {
+			*u32_state = value;
+			READ_WB_REG(ARM_OP2_WCR, i, *(u32_state+1)); // Read watchpoint control register
+		}
+		u32_state += __DR_U32_STATE_SIZE;
+	}
+}
+
 static inline void get_dr_state(void* state) {
 	unsigned i;
 	u32* u32_state = (u32*)state;
@@ -146,45 +183,6 @@ static inline void get_dr_state(void* state) {
 	}
 }
 
-// Static detection information: detections are handled sequentially.
-u32 new_state_buf[__DR_U32_STATE_SIZE];
-u32 old_state_buf[__DR_U32_STATE_SIZE];
-static dr_detect_t info = {
-	.new_state = (void*)new_state_buf,
-	.old_state = (void*)old_state_buf,
-	.index = 0 // Given at detection time
-};
-static inline void check_dr_state(const void* trusted_state) {
-	unsigned i;
-	u32 value = 0, cntrl = 0;
-	const u32* u32_t_state = (u32*)trusted_state;
-
-	for (i = 0; i < bp_slots;  i++) {
-		READ_WB_REG(ARM_OP2_BVR, i, value); // Read breakpoint value register
-		READ_WB_REG(ARM_OP2_BCR, i, cntrl); // Read breakpoint control register
-		if (value != *u32_t_state || cntrl != *(u32_t_state+1)) {
-			*(u32*)(info.new_state) = value;
-			*(u32*)(info.new_state + sizeof(u32)) = cntrl;
-			info.old_state = (void*)u32_t_state;
-			info.index = i;
-			handle_dr_detection(&info);
-		}
-		u32_t_state += __DR_U32_STATE_SIZE;
-	}
-	for (i = 0; i < wp_slots; i++) {
-		READ_WB_REG(ARM_OP2_WVR, i, value); // Read watchpoint value register
-		READ_WB_REG(ARM_OP2_WCR, i, cntrl); // Read watchpoint control register
-		if (value != *u32_t_state || cntrl != *(u32_t_state+1)) {
-			*(u32*)(info.new_state) = value;
-			*(u32*)(info.new_state + sizeof(u32)) = cntrl;
-			info.old_state = (void*)u32_t_state;
-			info.index = i + bp_slots;
-			handle_dr_detection(&info);
-		}
-		u32_t_state += __DR_U32_STATE_SIZE;
-	}
-}
-
 static inline void __restore_dr_state(dr_detect_t* info) {
 	u32* u32_state = (u32*)info->old_state;
 
@@ -319,28 +317,6 @@ u32 __unregister_dr_new[__UNREGISTER_DR_SIZE / sizeof(u32)] = {
 	0xE12FFF1E  // Opcode "1EFF2FE1" little-endian for "bx lr"
 };
 
-static void (*_patch_text)(void*, unsigned) = NULL;
-static inline void patch_ktext(void* addr, void* new_text, void* old_text, unsigned size) {
-	u32* u32_addr = (u32*)addr;
-	u32* u32_old = (u32*)old_text;
-	u32* u32_new = (u32*)new_text;
-	unsigned i;
-	if (!_patch_text) {
-		_patch_text = (void (*)(void*, unsigned))kallsyms_lookup_name("patch_text");
-	}
-	// patch_text() calls stop_machine() and flushes the text page for each instruction inserted.
-	// This could be optimized by using stop_machine() here to wrap the entire patch,
-	// and by calling __patch_text_real() instead of patch_text().
-	// Furthermore, instead of __patch_text_real(), patching could be done manually here,
-	// refreshing the kernel page only at the end.
-	// However, since this is only executed at module startup and shutdown,
-	// such an optimization is not really needed, and no wish to reinvent the wheel.
-	for (i = 0; i < size / sizeof(u32); i++) {
-		*(u32_old + i) = *(u32_addr + i); // Save 
-		_patch_text(u32_addr + i, *(u32_new + i)); // From asm/patch.h
-	}
-}
-
 #endif
 
 #endif
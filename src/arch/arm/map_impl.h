@@ -3,13 +3,15 @@
 
 #include <linux/kallsyms.h>
 #include <linux/unistd.h>
-#include <linux/stop_machine.h>
-#include <asm/cacheflush.h>
-#include <asm/tlbflush.h>
+
+#include "patch.h"
 
 #include <linux/notifier.h>
 #include <asm/thread_info.h>
 #include <asm/thread_notify.h>
+#ifdef MAP_EXIT_TRACEPOINT
+#include <linux/tracepoint.h>
+#endif
 
 static void** sys_call_table;
 static void* original_syscalls[HOOKS_COUNT];
@@ -30,25 +32,75 @@ static struct notifier_block exit_notifier_block = {
 	.notifier_call  = exit_notifier,
 };
 
-static int __patch_map_syscalls(void* arg) {
-	void** addrs = (void**)arg;
+#ifdef MAP_EXIT_TRACEPOINT
 
-	sys_call_table[__NR_mmap2] = addrs[MMAP2_INDEX];
-	sys_call_table[__NR_mremap] = addrs[MREMAP_INDEX];
-	sys_call_table[__NR_remap_file_pages] = addrs[REMAP_FILE_PAGES_INDEX];
-	sys_call_table[__NR_munmap] = addrs[MUNMAP_INDEX];
+/*
+ * The ARM thread notifier chain is also run on each context switch (THREAD_NOTIFY_SWITCH),
+ * so the notifier above costs an indirect call on every switch of the system, just to ignore it.
+ * The sched_process_exit tracepoint is only hit in do_exit(), once for each exiting task.
+ * The tracepoint is not exported to modules, so it is looked up as any other kernel symbol.
+ * If it is not available, the thread notifier is used instead.
+ */
+static struct tracepoint* exit_tracepoint;
 
-	flush_cache_all();
-	flush_tlb_all();
-	return 0;
+// Probes run under rcu_read_lock_sched(), so the callback must not sleep (see map_list.h)
+static void exit_probe(void* data, struct task_struct* task) {
+	free_maps_callback(task->pid);
 }
 
-static void patch_map_syscalls(void** addrs) {
-	stop_machine(__patch_map_syscalls, (void*)addrs, NULL);
+static void register_exit_notifier(void) {
+	exit_tracepoint = (struct tracepoint*)kallsyms_lookup_name("__tracepoint_sched_process_exit");
+	if (exit_tracepoint && !tracepoint_probe_register(exit_tracepoint, exit_probe, NULL)) {
+		log_info("MAP monitor: exit notification through sched_process_exit tracepoint\n");
+		return;
+	}
+	exit_tracepoint = NULL;
+	log_info("MAP monitor: sched_process_exit tracepoint not available, using thread notifier\n");
+	thread_register_notifier(&exit_notifier_block);
 }
 
-static void hook_map_syscalls(void** hooks, void** addrs, free_maps_t fm) {
+static void unregister_exit_notifier(void) {
+	if (exit_tracepoint) {
+		tracepoint_probe_unregister(exit_tracepoint, exit_probe, NULL);
+		tracepoint_synchronize_unregister(); // Wait for running probes before unloading
+	} else {
+		thread_unregister_notifier(&exit_notifier_block);
+	}
+}
+
+#else
+
+// Use the notifier implemented for ARM (<asm/thread_notify.h>).
+// Overhead: normal function call, on each context switch too.
+#define register_exit_notifier()  	thread_register_notifier(&exit_notifier_block)
+#define unregister_exit_notifier()	thread_unregister_notifier(&exit_notifier_block)
+
+#endif
+
+// Entries are written by the current patch transaction (see patch.h),
+// together with the other kernel patches, flushing only the written entries.
+// A failed write discards the whole transaction, so no syscall is left half hooked.
+#define __queue_syscall(nr, addr)	queue_data_patch(&sys_call_table[nr], &(addr), NULL, sizeof(void*))
+
+static int patch_map_syscalls(void** addrs) {
+	int res;
+
+	if ( (res = __queue_syscall(__NR_mmap2, addrs[MMAP2_INDEX])) ||
+	     (res = __queue_syscall(__NR_mremap, addrs[MREMAP_INDEX])) ||
+	     (res = __queue_syscall(__NR_remap_file_pages, addrs[REMAP_FILE_PAGES_INDEX])) ||
+	     (res = __queue_syscall(__NR_munmap, addrs[MUNMAP_INDEX])) )
+		log_err("Unable to hook mapping syscalls: %d\n", res);
+	return res;
+}
+
+static int hook_map_syscalls(void** hooks, void** addrs, free_maps_t fm) {
+	int res;
+
 	sys_call_table = (void**)kallsyms_lookup_name("sys_call_table");
+	if (!sys_call_table) {
+		log_err("Unable to find the syscall table\n");
+		return -ENOENT;
+	}
 
 	// Save original system calls
 	original_syscalls[MMAP2_INDEX] = sys_call_table[__NR_mmap2];
@@ -67,10 +119,10 @@ static void hook_map_syscalls(void** hooks, void** addrs, free_maps_t fm) {
 
 	// Place our hooks
 	free_maps_callback = fm;
-	patch_map_syscalls(hooks);
-	// Use the notifier implemented for ARM (<asm/thread_notify.h>).
-	// Overhead: normal function call.
-	thread_register_notifier(&exit_notifier_block);
+	if ( (res = patch_map_syscalls(hooks)) )
+		return res;
+	register_exit_notifier();
+	return 0;
 }
 
 static inline int is_phys_mem(unsigned long fd) {
@@ -86,7 +138,7 @@ bad_fd:
 
 static void restore_map_syscalls(void) {
 	// Remove our hooks
-	thread_unregister_notifier(&exit_notifier_block);
+	unregister_exit_notifier();
 	patch_map_syscalls(original_syscalls);
 }
 
@@ -0,0 +1,46 @@
+#ifndef __PATCH_IMPL_H
+#define __PATCH_IMPL_H
+
+#include <linux/kallsyms.h>
+#include <linux/errno.h>
+
+/*
+ * patch_text() (asm/patch.h) calls stop_machine() for each instruction, then __patch_text_real(),
+ * which writes one word (remapping it through a fixmap if kernel text is read-only)
+ * and flushes the icache for that word only. Here the machine is already stopped,
+ * so __patch_text_real() is called directly. Without it, kernel text cannot be written safely,
+ * and no patch is applied.
+ */
+static void (*_patch_text_real)(void*, unsigned int, bool) = NULL;
+
+static inline int init_patch(void) {
+	if (!_patch_text_real)
+		_patch_text_real = (void (*)(void*, unsigned int, bool))kallsyms_lookup_name("__patch_text_real");
+	return _patch_text_real ? 0 : -ENOSYS;
+}
+
+static inline void __patch_words(u32* addr, const u32* words, unsigned count) {
+	unsigned i;
+
+	for (i = 0; i < count; i++)
+		_patch_text_real(addr + i, words[i], true); // Flushes the written word
+}
+
+/*
+ * The syscall table is part of the kernel image: when its sections are read-only,
+ * the fixmap of __patch_text_real() is the only writable alias available with the machine stopped
+ * (the icache flush of the word is useless, but harmless). Otherwise it is written in place.
+ */
+static inline void __patch_data(u32* addr, const u32* words, unsigned count) {
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+#if defined(CONFIG_STRICT_KERNEL_RWX) || defined(CONFIG_DEBUG_RODATA)
+		_patch_text_real(addr + i, words[i], true);
+#else
+		WRITE_ONCE(addr[i], words[i]);
+#endif
+	}
+}
+
+#endif
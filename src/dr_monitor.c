@@ -2,81 +2,185 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/errno.h>
-#include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/semaphore.h>
+#include <linux/smp.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
 
 #include "dr_monitor.h"
 #include "dr_conf.h"
 #include "dr_debug.h"
+#include "scheduler.h"
+#include "patch.h"
+#include "events.h"
 
 static unsigned dr_count; // Number of available debug registers
-static const void* volatile trusted_state; // Trusted debug registers state
-static struct task_struct* task; // DR monitor main task
+/*
+ * Debug registers are per CPU, and each CPU can only access its own: a DR set on a CPU is not seen by the others.
+ * Each CPU has its own trusted state, and its own buffer for the current state.
+ * On each check, the current state of all the CPUs is taken with a single cross-call: the other CPUs run it
+ * in parallel, and they only copy their DRs into their own buffer (no comparison, no locks), while the local CPU
+ * is read directly. The comparison is done by the monitor afterwards. The cost grows with the number of CPUs
+ * by one short interrupt each, and a CPU is interrupted again only to restore its own DRs (see handle_dr_detection).
+ * Only the CPUs online at startup are checked.
+ */
+static void __percpu* volatile trusted_state; // Trusted debug registers state of each CPU
+static void __percpu* current_state; // Current debug registers state of each CPU, as of the last check
+static struct cpumask dr_cpus; // CPUs to check
 DEFINE_MUTEX(trusted_lock); // Mutex to protect trusted state
+static unsigned wp_count; // Number of available watchpoints
+static struct semaphore wp_pool; // Free watchpoint slots
 
-static int monitor_loop(void* data);
-static void disable_user_dr_interface(void);
+// Watchpoint slots handed out by the pool.
+// If the architecture can retarget a DR, each slot has a wide DR allocated once at startup and kept disabled:
+// claiming a slot only updates the target of its DR and enables it, with no allocation.
+// Otherwise the DR is registered when the slot is claimed, and unregistered when it is released.
+// A wide DR only has events on the CPUs online when it was registered: CPUs brought online later are left out.
+typedef struct {
+	struct perf_event* __percpu* bp; // DR of the slot
+	struct cpumask cpus; // CPUs with an event of the preallocated DR
+	void* vaddr; // Current target
+	int busy;
+} dr_slot_t;
+
+static dr_slot_t* slots;
+static int prealloc; // Whether DRs are preallocated
+static DEFINE_SPINLOCK(slot_lock); // To protect slot claims
+
+static void monitor_check(void);
+static void get_cpu_dr_state(void* state);
+static void snapshot_dr_state(void);
+static int disable_user_dr_interface(void);
 static void enable_user_dr_interface(void);
+static int alloc_slots(void);
+static void free_slots(void);
+
+static sched_check_t dr_check = {
+	.name = "DR monitor",
+	.check = monitor_check,
+	.interval = DR_MONITOR_INTERVAL
+};
+module_param_cb(dr_interval, &sched_interval_ops, &dr_check, 0644);
+MODULE_PARM_DESC(dr_interval, "DR monitor interval in microseconds");
 
 int start_dr_monitor(void) {
 	int res;
 
 	// Get number of available debug registers
 	dr_count = count_drs();
+	wp_count = 0;
 	if (dr_count == 0) {
 		log_info("DR monitor not needed\n");
 		return 0;
 	}
 	
-	// Allocate space for trusted state
-	trusted_state = kmalloc(DR_STATE_SIZE * dr_count, GFP_KERNEL);
-	if (!trusted_state) {
+	// Allocate space for trusted and current state of each CPU, each one in its own cache lines
+	trusted_state = __alloc_percpu(DR_STATE_SIZE * dr_count, L1_CACHE_BYTES);
+	current_state = __alloc_percpu(DR_STATE_SIZE * dr_count, L1_CACHE_BYTES);
+	if (!trusted_state || !current_state) {
 		log_err("Unable to allocate kernel space for DR monitor\n");
 		res = -ENOMEM;
 		goto trusted_failed;
 	}
+	cpumask_copy(&dr_cpus, cpu_online_mask);
 
-	// Disable user DR interface
-	disable_user_dr_interface();
+	// Allocate watchpoint slots
+	if ( (res = alloc_slots()) )
+		goto slots_failed;
+	sema_init(&wp_pool, wp_count);
 
-	// Get DR trusted state
-	get_dr_state((void*)trusted_state);
+	// Disable user DR interface (applied with the current patch transaction)
+	if ( (res = disable_user_dr_interface()) )
+		goto interface_failed;
 
-	// Start monitor task
-	task = kthread_run(&monitor_loop, NULL, "dr_monitor");
-	if (IS_ERR((void*)task)) {
-		log_err("Unable to create thread: %ld\n", PTR_ERR((void*)task));
-		res = PTR_ERR((void*)task);
-		goto task_failed;
-	}
+	// Get DR trusted state of each CPU
+	on_each_cpu(get_cpu_dr_state, trusted_state, 1);
+	snapshot_dr_state();
+
+	dump_dr_state(cpumask_first(&dr_cpus));
+
+	// Register monitor check
+	register_check(&dr_check);
 
 	log_info("DR monitor started\n");
 	return 0;
 
-task_failed:
-	kfree((void*)trusted_state);
+interface_failed:
+	free_slots();
+slots_failed:
 trusted_failed:
+	free_percpu(current_state);
+	free_percpu(trusted_state);
+	trusted_state = current_state = NULL;
 	return res;
 }
 
-static int monitor_loop(void* data) {
-	dump_dr_state();
-	while(1) {
-		mutex_lock(&trusted_lock);
-		// Check DR state
-		check_dr_state(trusted_state);
-		mutex_unlock(&trusted_lock);
+// Run on each CPU by cross-calls, with interrupts disabled
+static void get_cpu_dr_state(void* state) {
+	get_dr_state(this_cpu_ptr((void __percpu*)state));
+}
+
+static void update_cpu_dr_slot(void* vaddr) {
+	update_dr_slot(this_cpu_ptr(trusted_state), vaddr);
+}
+
+static void restore_cpu_dr_state(void* info) {
+	restore_dr_state((dr_detect_t*)info);
+}
+
+// The current CPU is excluded from the cross-call (see above)
+static void snapshot_dr_state(void) {
+	int cpu = get_cpu();
+
+	get_dr_state(per_cpu_ptr(current_state, cpu));
+	smp_call_function_many(&dr_cpus, get_cpu_dr_state, current_state, 1);
+	put_cpu();
+}
 
-		usleep_range(DR_MIN_RANGE(DR_MONITOR_INTERVAL), DR_MAX_RANGE(DR_MONITOR_INTERVAL));
-		if (kthread_should_stop()) return 0;
+static void monitor_check(void) {
+	const char *trusted, *state;
+	dr_detect_t info;
+	unsigned i;
+	int cpu;
+
+	mutex_lock(&trusted_lock);
+	snapshot_dr_state();
+	for_each_cpu_and(cpu, &dr_cpus, cpu_online_mask) {
+		trusted = per_cpu_ptr(trusted_state, cpu);
+		state = per_cpu_ptr(current_state, cpu);
+		if (likely(!memcmp(state, trusted, DR_STATE_SIZE * dr_count))) continue; // Nothing changed on this CPU
+
+		for (i = 0; i < dr_count; i++) { // For each DR
+			if (memcmp(state, trusted, DR_STATE_SIZE)) {
+				info.new_state = state;
+				info.old_state = trusted;
+				info.index = i;
+				info.cpu = cpu;
+				handle_dr_detection(&info);
+			}
+			state += DR_STATE_SIZE;
+			trusted += DR_STATE_SIZE;
+		}
 	}
-	return 0;
+	mutex_unlock(&trusted_lock);
 }
 
+// DRs can only be restored by their own CPU
 void handle_dr_detection(dr_detect_t* info) {
-	log_info("Change detected on DR#%u state\n", info->index);
-	dump_dr_state();
-	restore_dr_state(info);
+	u64 old_state = 0, new_state = 0;
+
+	// The state is recorded as far as it fits into the event
+	memcpy(&old_state, info->old_state, min_t(size_t, DR_STATE_SIZE, sizeof(u64)));
+	memcpy(&new_state, info->new_state, min_t(size_t, DR_STATE_SIZE, sizeof(u64)));
+	record_event(GB_EVENT_DR, GB_VERDICT_ILLEGAL, info->cpu, info->index, old_state, new_state, 0);
+	log_event("Change detected on DR#%u state of CPU %u\n", info->index, info->cpu);
+	sched_alert();
+	dump_dr_state(info->cpu);
+#ifdef DR_MONITOR_ACTIVE
+	smp_call_function_single(info->cpu, restore_cpu_dr_state, info, 1);
+#endif
 }
 
 static char register_user_dr_old[REGISTER_USER_DR_SIZE];
@@ -84,54 +188,211 @@ static char modify_user_dr_old[MODIFY_USER_DR_SIZE];
 static char unregister_dr_old[UNREGISTER_DR_SIZE];
 static void *register_user_hw_breakpoint_addr, *modify_user_hw_breakpoint_addr, *unregister_hw_breakpoint_addr;
 
-#define toggle_user_dr_interface(x, y) do {                                                                                      \
-	patch_ktext(register_user_hw_breakpoint_addr, register_user_dr_ ## x, (void*)register_user_dr_ ## y, REGISTER_USER_DR_SIZE);  \
-	patch_ktext(modify_user_hw_breakpoint_addr, modify_user_dr_ ## x, (void*)modify_user_dr_ ## y, MODIFY_USER_DR_SIZE);          \
-	patch_ktext(unregister_hw_breakpoint_addr, unregister_dr_ ## x, (void*)unregister_dr_ ## y, UNREGISTER_DR_SIZE);              \
-} while(0)
+// Patches are applied by the current patch transaction (see patch.h),
+// saving the replaced text into the other buffers.
+#define toggle_user_dr_interface(x, y)                                                                                                   \
+	(queue_patch(register_user_hw_breakpoint_addr, register_user_dr_ ## x, (void*)register_user_dr_ ## y, REGISTER_USER_DR_SIZE) ||  \
+	 queue_patch(modify_user_hw_breakpoint_addr, modify_user_dr_ ## x, (void*)modify_user_dr_ ## y, MODIFY_USER_DR_SIZE) ||          \
+	 queue_patch(unregister_hw_breakpoint_addr, unregister_dr_ ## x, (void*)unregister_dr_ ## y, UNREGISTER_DR_SIZE))
 
-static void disable_user_dr_interface(void) {
+static int disable_user_dr_interface(void) {
 	register_user_hw_breakpoint_addr = (void*) kallsyms_lookup_name("register_user_hw_breakpoint");
 	modify_user_hw_breakpoint_addr = (void*) kallsyms_lookup_name("modify_user_hw_breakpoint");
 	unregister_hw_breakpoint_addr = (void*) kallsyms_lookup_name("unregister_hw_breakpoint");
-	toggle_user_dr_interface(new, old); // Patch kernel text with opcodes
+	if (!register_user_hw_breakpoint_addr || !modify_user_hw_breakpoint_addr || !unregister_hw_breakpoint_addr) {
+		log_err("Unable to find the user DR interface\n");
+		return -ENOENT;
+	}
+
+	// Saved now as well: if the transaction is discarded, reverting writes the original text back
+	memcpy(register_user_dr_old, register_user_hw_breakpoint_addr, REGISTER_USER_DR_SIZE);
+	memcpy(modify_user_dr_old, modify_user_hw_breakpoint_addr, MODIFY_USER_DR_SIZE);
+	memcpy(unregister_dr_old, unregister_hw_breakpoint_addr, UNREGISTER_DR_SIZE);
+	return toggle_user_dr_interface(new, old) ? -ENOSPC : 0; // Patch kernel text with opcodes
 }
 
 static void enable_user_dr_interface(void) {
-	toggle_user_dr_interface(old, new); // Revert patches
+	if (toggle_user_dr_interface(old, new)) // Revert patches
+		log_err("Unable to restore the user DR interface\n");
+}
+
+// Placeholder handler and target of preallocated DRs, until claimed.
+// ARM rejects kernel addresses and per-CPU events with the default handler:
+// the target is the first user page, which is never mapped (mmap_min_addr).
+#define DR_PLACEHOLDER_ADDR	PAGE_SIZE
+
+static void placeholder_handler(struct perf_event* bp, struct perf_sample_data* data, struct pt_regs* regs) {}
+
+static int alloc_slots(void) {
+	struct perf_event_attr attr;
+	struct perf_event* __percpu* bp;
+	unsigned count = count_watch_drs();
+	int cpu;
+
+	slots = kcalloc(count, sizeof(dr_slot_t), GFP_KERNEL);
+	if (!slots) {
+		log_err("Unable to allocate kernel space for DR slots\n");
+		return -ENOMEM;
+	}
+
+	prealloc = can_retarget_dr();
+	if (prealloc) {
+		hw_breakpoint_init(&attr);
+		attr.bp_addr = DR_PLACEHOLDER_ADDR;
+		attr.bp_len = HW_BREAKPOINT_LEN_4;
+		attr.bp_type = HW_BREAKPOINT_W;
+		attr.disabled = 1;
+		for (wp_count = 0; wp_count < count; wp_count++) {
+			bp = register_wide_hw_breakpoint(&attr, placeholder_handler, NULL);
+			if (IS_ERR((void*)bp)) {
+				// The pool is limited to the DRs registered so far
+				log_info("Unable to preallocate DR #%u: %ld\n", wp_count, PTR_ERR((void*)bp));
+				break;
+			}
+			slots[wp_count].bp = bp;
+			for_each_possible_cpu(cpu) {
+				if (per_cpu(*bp, cpu)) cpumask_set_cpu(cpu, &slots[wp_count].cpus);
+			}
+		}
+		if (wp_count) {
+			log_info("%u DRs preallocated\n", wp_count);
+			return 0;
+		}
+		prealloc = 0;
+	}
+
+	log_info("DRs cannot be retargeted, they will be registered on demand\n");
+	wp_count = count;
+	return 0;
+}
+
+static void free_slots(void) {
+	unsigned i;
+
+	if (prealloc) {
+		for (i = 0; i < wp_count; i++)
+			__reset_dr(slots[i].bp);
+	}
+	kfree(slots);
+	wp_count = 0;
+}
+
+static dr_slot_t* claim_slot(void) {
+	dr_slot_t* slot = slots;
+
+	spin_lock(&slot_lock);
+	while (slot->busy) slot++; // The pool guarantees a free slot
+	slot->busy = 1;
+	spin_unlock(&slot_lock);
+	return slot;
+}
+
+static void release_slot(dr_slot_t* slot) {
+	spin_lock(&slot_lock);
+	slot->busy = 0;
+	spin_unlock(&slot_lock);
+	up(&wp_pool);
 }
 
-static void* set_dr(int pid, void* vaddr, dr_handler_t handler, unsigned type) {
-	void* dr;
+// Preallocated DRs are disabled while retargeted: the handler is changed on each CPU, then they are enabled.
+// Only the events of the slot are used, with CPU hotplug held off meanwhile.
+static int arm_slot(dr_slot_t* slot, dr_handler_t handler, void* context, unsigned type) {
+	struct perf_event* bp;
+	int cpu, res = 0;
+
+	cpus_read_lock();
+	for_each_cpu(cpu, &slot->cpus) {
+		bp = per_cpu(*slot->bp, cpu);
+		bp->overflow_handler = handler;
+		bp->overflow_handler_context = context;
+		if ( (res = __retarget_dr(bp, slot->vaddr, type)) )
+			goto out;
+	}
+	for_each_cpu(cpu, &slot->cpus) {
+		perf_event_enable(per_cpu(*slot->bp, cpu));
+	}
+out:
+	cpus_read_unlock();
+	return res;
+}
+
+static void disarm_slot(dr_slot_t* slot) {
+	int cpu;
+
+	cpus_read_lock();
+	for_each_cpu(cpu, &slot->cpus) {
+		perf_event_disable(per_cpu(*slot->bp, cpu));
+	}
+	cpus_read_unlock();
+}
+
+// Only watchpoints are handed out: claim a slot from the pool, waiting for it if needed.
+// Only the trusted state of the claimed slot is updated.
+static void* set_dr(int pid, void* vaddr, dr_handler_t handler, void* context, unsigned type) {
+	dr_slot_t* slot;
+	int res = 0;
+
+	if (!wp_count) return NULL;
+	down(&wp_pool);
+	slot = claim_slot();
+	slot->vaddr = vaddr;
+
 	mutex_lock(&trusted_lock);
-	dr = __set_dr(pid, vaddr, handler, type);
-	if (trusted_state) get_dr_state((void*)trusted_state);
+	if (prealloc) {
+		res = arm_slot(slot, handler, context, type);
+	} else {
+		slot->bp = __set_dr(pid, vaddr, handler, context, type);
+		if (!slot->bp) res = -EBUSY;
+	}
+	if (trusted_state && !res) on_each_cpu(update_cpu_dr_slot, vaddr, 1);
 	mutex_unlock(&trusted_lock);
-	return dr;
+
+	if (res) {
+		log_err("Unable to set DR on 0x%08lx: %d\n", (long)vaddr, res);
+		release_slot(slot);
+		return NULL;
+	}
+	return slot;
 }
 
-void* set_read_dr(int pid, void* vaddr, dr_handler_t handler) {
-	return set_dr(pid, vaddr, handler, HW_BREAKPOINT_R);
+void* set_read_dr(int pid, void* vaddr, dr_handler_t handler, void* context) {
+	return set_dr(pid, vaddr, handler, context, HW_BREAKPOINT_R);
 }
 
-void* set_write_dr(int pid, void* vaddr, dr_handler_t handler) {
-	return set_dr(pid, vaddr, handler, HW_BREAKPOINT_W);
+void* set_write_dr(int pid, void* vaddr, dr_handler_t handler, void* context) {
+	return set_dr(pid, vaddr, handler, context, HW_BREAKPOINT_W);
 }
 
 void reset_dr(void* dr) {
+	dr_slot_t* slot = (dr_slot_t*)dr;
+
+	if (!slot) return;
 	mutex_lock(&trusted_lock);
-	__reset_dr(dr);
-	if (trusted_state) get_dr_state((void*)trusted_state);
+	if (prealloc) {
+		disarm_slot(slot);
+	} else {
+		__reset_dr(slot->bp);
+		slot->bp = NULL;
+	}
+	if (trusted_state) on_each_cpu(update_cpu_dr_slot, slot->vaddr, 1);
 	mutex_unlock(&trusted_lock);
+	release_slot(slot);
+}
+
+unsigned watch_dr_slots(void) {
+	count_drs();
+	return count_watch_drs();
 }
 
 void stop_dr_monitor(void) {
 	if (dr_count > 0) {
-		kthread_stop(task);
+		unregister_check(&dr_check);
 		mutex_lock(&trusted_lock);
-		kfree((void*)trusted_state);
-		trusted_state = NULL;
+		free_percpu(current_state);
+		free_percpu(trusted_state);
+		trusted_state = current_state = NULL;
 		mutex_unlock(&trusted_lock);
+		free_slots();
 		enable_user_dr_interface();
 		log_info("DR monitor stopped\n");
 	}
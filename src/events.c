@@ -0,0 +1,147 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/miscdevice.h>
+#include <linux/ktime.h>
+#include <linux/smp.h>
+
+#include "log.h"
+#include "events.h"
+#include "scheduler.h"
+
+#define EVENT_RING_SIZE	PAGE_ALIGN(sizeof(gb_event_ring_t) + EVENT_RECORDS * sizeof(gb_event_t))
+#define EVENT_MONITORS 	3
+#define EVENT_SUMMARY_INTERVAL	SCHED_MAX_INTERVAL
+
+static gb_event_ring_t* ring; // Ring header, followed by the records
+static gb_event_t* records;
+static atomic_t count[EVENT_MONITORS]; // Events of each monitor
+static atomic_t illegal; // Illegal events of all the monitors
+static unsigned reported[EVENT_MONITORS], reported_illegal; // Counters as of the last summary
+static bool event_summary = true;
+
+static void summary_check(void);
+
+static sched_check_t summary = {
+	.name = "Event summary",
+	.check = summary_check,
+	.interval = EVENT_SUMMARY_INTERVAL
+};
+
+static int events_mmap(struct file* file, struct vm_area_struct* vma) {
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > EVENT_RING_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	// Readers only, also through mprotect
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND;
+	return remap_vmalloc_range(vma, ring, 0);
+}
+
+static const struct file_operations events_fops = {
+	.owner = THIS_MODULE, // The module cannot be removed while the ring is mapped
+	.mmap = events_mmap
+};
+
+static struct miscdevice events_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = EVENT_DEVICE,
+	.fops = &events_fops,
+	.mode = 0400
+};
+
+int start_events(void) {
+	int res, i;
+
+	BUILD_BUG_ON_NOT_POWER_OF_2(EVENT_RECORDS);
+
+	// Zeroed, and mappable to userspace
+	ring = vmalloc_user(EVENT_RING_SIZE);
+	if (!ring) {
+		log_err("Unable to allocate kernel space for event ring\n");
+		return -ENOMEM;
+	}
+	ring->size = EVENT_RECORDS;
+	ring->record_size = sizeof(gb_event_t);
+	ring->offset = sizeof(gb_event_ring_t);
+	records = (gb_event_t*)(ring + 1);
+	for (i = 0; i < EVENT_MONITORS; i++) {
+		atomic_set(&count[i], 0);
+		reported[i] = 0;
+	}
+	atomic_set(&illegal, 0);
+	reported_illegal = 0;
+
+	if ( (res = misc_register(&events_dev)) ) {
+		log_err("Unable to register event device: %d\n", res);
+		vfree(ring);
+		ring = NULL;
+		return res;
+	}
+
+	register_check(&summary);
+	log_info("Event ring ready (%u records)\n", EVENT_RECORDS);
+	return 0;
+}
+
+// The scheduler is already stopped
+void stop_events(void) {
+	if (!ring) return;
+	unregister_check(&summary);
+	summary_check();
+	misc_deregister(&events_dev);
+	vfree(ring);
+	ring = NULL;
+}
+
+void record_event(unsigned monitor, unsigned verdict, unsigned cpu, u64 target, u64 old_value, u64 new_value, pid_t pid) {
+	gb_event_t* e;
+	u32 i;
+
+	if (!ring) return;
+
+	// Reserve the record, then write it between the two updates of its sequence number
+	i = (u32)atomic_inc_return((atomic_t*)&ring->head) - 1;
+	e = &records[i & (EVENT_RECORDS - 1)];
+	WRITE_ONCE(e->seq, 0);
+	smp_wmb();
+	e->monitor = monitor;
+	e->verdict = verdict;
+	e->cpu = cpu;
+	e->time = ktime_get_ns();
+	e->target = target;
+	e->old_value = old_value;
+	e->new_value = new_value;
+	e->pid = pid;
+	smp_wmb();
+	WRITE_ONCE(e->seq, i + 1);
+
+	atomic_inc(&count[monitor]);
+	if (verdict == GB_VERDICT_ILLEGAL) atomic_inc(&illegal);
+}
+
+// Low-rate summary of the events, printed only when there are new ones
+static void summary_check(void) {
+	unsigned cur[EVENT_MONITORS], cur_illegal, i;
+
+	for (i = 0; i < EVENT_MONITORS; i++)
+		cur[i] = atomic_read(&count[i]);
+	cur_illegal = atomic_read(&illegal);
+	if (cur_illegal == reported_illegal && !memcmp(cur, reported, sizeof(cur))) return;
+
+	if (READ_ONCE(event_summary)) {
+		log_info("Events: %u I/O, %u DR, %u MAP (%u illegal), see /dev/" EVENT_DEVICE "\n",
+		         cur[GB_EVENT_IO] - reported[GB_EVENT_IO], cur[GB_EVENT_DR] - reported[GB_EVENT_DR],
+		         cur[GB_EVENT_MAP] - reported[GB_EVENT_MAP], cur_illegal - reported_illegal);
+	}
+	memcpy(reported, cur, sizeof(cur));
+	reported_illegal = cur_illegal;
+}
+
+module_param(event_summary, bool, 0644);
+MODULE_PARM_DESC(event_summary, "Print a summary of the detection events at most once a second");
@@ -10,6 +10,7 @@ typedef struct {
 	const void* new_state; // New debug register state
 	const void* old_state; // Old debug register state
 	unsigned index;        // Debug register index
+	unsigned cpu;          // CPU of the debug register
 } dr_detect_t;
 
 // Debug register change detection handler.
@@ -34,7 +35,7 @@ extern void handle_dr_detection(dr_detect_t*);
  * get their current state, compare it with a given state and, if needed, restore a given state.
  * The state of a single debug register can be made of a different number of registers, depending on the architecture.
  *
- * For user side DR protection, the implementation should define the opcodes and the patch_ktext() function to patch kernel text.
+ * For user side DR protection, the implementation should define the opcodes to patch kernel text with (see patch.h).
  * This is used to disable the DR user interface provided by the kernel.
  * In this way, the access to DRs from user-space is denied.
  */
@@ -60,34 +61,56 @@ extern void handle_dr_detection(dr_detect_t*);
 static inline unsigned count_drs(void);
 
 /*
- * Get the current state of the available debug registers and store it into the given pointer.
- * @state is allocated and freed by the monitor, the implementation should just use it to store the data.
+ * The monitor hands out the available watchpoints to the users of the DR interface (see dr_monitor.h).
+ * Called after count_drs().
  *
- * @state: pointer to the DR state data structure, _already_ allocated
+ * Return: the number of available watchpoints
  */
-static inline void get_dr_state(void* state);
+static inline unsigned count_watch_drs(void);
 
 /*
- * Read and compare the current DR state with the trusted state.
- * If a mismatch is detected, then handle_dr_detection() should be called,
- * providing the necessary information through a dr_detect_t object.
+ * Watchpoints are preallocated by the monitor and retargeted on each claim, if the implementation supports it.
+ * Retargeting a DR must rebuild its architecture-specific info (as register_wide_hw_breakpoint() does)
+ * for the new address and access type, without allocating anything. The DR is disabled meanwhile.
+ * The trusted state is then updated only for the watchpoint slot that has been enabled or disabled,
+ * which is recognized by its target address, instead of reading all the debug registers again.
+ * update_dr_slot() is called on each CPU by a cross-call, with the trusted state of that CPU.
+ *
+ * @bp: the DR event on a single CPU, disabled
+ * @vaddr: the new target address
+ * @type: the new access type (HW_BREAKPOINT_R or HW_BREAKPOINT_W)
+ * @state: the trusted DR state
  *
- * @trusted_state: the trusted state to check the DRs against
+ * can_retarget_dr() returns non-zero if DRs can be retargeted, __retarget_dr() returns 0 on success.
  */
-static inline void check_dr_state(const void* trusted_state);
+static inline int can_retarget_dr(void);
+static inline int __retarget_dr(struct perf_event* bp, void* vaddr, unsigned type);
+static inline void update_dr_slot(void* state, void* vaddr);
 
 /*
- * Restore a debug register to its trusted state.
+ * Get the current state of the available debug registers of the current CPU and store it into the given pointer.
+ * @state is allocated and freed by the monitor, the implementation should just use it to store the data.
+ * The state is made of DR_STATE_SIZE bytes for each DR, in the order of their index: the monitor compares
+ * the state of each DR with its trusted state, and calls handle_dr_detection() for each mismatch.
+ * This is called on each CPU by a cross-call, with interrupts disabled: it must only read the DRs, as fast as possible.
  *
- * @info: the information about the detected DR change, as filled in by check_dr_state()
+ * @state: pointer to the DR state data structure, _already_ allocated
+ */
+static inline void get_dr_state(void* state);
+
+/*
+ * Restore a debug register of the current CPU to its trusted state.
+ * This is called on the CPU of the detection (@info->cpu) by a cross-call, with interrupts disabled.
+ *
+ * @info: the information about the detected DR change
  */
 static inline void __restore_dr_state(dr_detect_t* info);
 
 #ifdef DR_MONITOR_ACTIVE
 
-#define restore_dr_state(x) 	do {    	\
-	__restore_dr_state(x);          	\
-	log_info("DR state restored\n");	\
+#define restore_dr_state(x) 	do {     	\
+	__restore_dr_state(x);           	\
+	log_event("DR state restored\n");	\
 } while(0)
 
 #else
@@ -145,20 +168,9 @@ static inline void __restore_dr_state(dr_detect_t* info);
  * };
  *
  * Where <type> has the same size of an opcode, or any size preferred by the implementation.
+ * Sizes must be a multiple of 4 bytes, since text is patched in words (see patch.h).
  */
 
-/*
- * Patch the text of a kernel function pointed by @addr with the given @new_text of @size bytes,
- * after saving the previous code from @addr into @old_text.
- * Pointers are already allocated and are managed by the caller.
- *
- * @addr: the kernel text address to patch
- * @new_text: the text to write starting from @addr
- * @old_text: buffer to save previous text from @addr
- * @size: size of text to save/patch, in bytes
- */
-static inline void patch_ktext(void* addr, void* new_text, void* old_text, unsigned size);
-
 
 /*
  * Include architecture-dependent debug registers header.
@@ -9,19 +9,10 @@
  *
  * In order to simplify debug, this file provides macros to dump
  * the state of the resources monitored by the DR monitor.
- *
- * Since the number of DR registers is not known at compile time,
- * and to avoid the use of dynamic memory with kmalloc (which may fail),
- * here the maximum number of DR registers is supposed to be 32
- * (which is quite large for almost every architecture).
- * If it's not enough, modify it accordingly to the specific implementation.
  */
 
 #ifdef DR_DEBUG // DR debug subsystem enabled
 
-#define DR_MAX_STATE_SIZE	(DR_STATE_SIZE * 32)
-
-char dr_state[DR_MAX_STATE_SIZE];
 static void __dump_dr_state(volatile void* state) {
 	unsigned i, j;
 	for (i = 0; i < count_drs(); i++) {
@@ -33,23 +24,20 @@ static void __dump_dr_state(volatile void* state) {
 		log_cont("\n");
 	}
 }
-static void __dump_dr_current_state(void) {
-	get_dr_state((void*)dr_state);
-	__dump_dr_state(dr_state);
-}
 
-#define dump_dr_state() do {                  	\
-	log_info("--- Start DR dump ---\n");  	\
-	log_info("DR trusted state:\n");      	\
-	__dump_dr_state((void*)trusted_state);	\
-	log_info("DR current state:\n");      	\
- 	__dump_dr_current_state();            	\
-	log_info("--- End DR dump ---\n");    	\
+// State of the given CPU, as of the last check
+#define dump_dr_state(cpu) do {                                	\
+	log_info("--- Start DR dump (CPU %u) ---\n", cpu);     	\
+	log_info("DR trusted state:\n");                       	\
+	__dump_dr_state(per_cpu_ptr(trusted_state, cpu));      	\
+	log_info("DR current state:\n");                       	\
+	__dump_dr_state(per_cpu_ptr(current_state, cpu));      	\
+	log_info("--- End DR dump ---\n");                     	\
 } while (0)
 
 #else // DR debug subsystem disabled
 
-#define dump_dr_state() 	(void)0
+#define dump_dr_state(cpu) 	(void)0
 
 #endif
 
@@ -3,6 +3,7 @@
 
 #include <linux/perf_event.h>
 #include <linux/hw_breakpoint.h>
+#include <linux/percpu.h>
 
 /*
  * This monitor is responsible for protecting debug registers from malicious usage.
@@ -35,11 +36,19 @@
  * Furthermore, even if this monitor is disabled, an interface to have access to debug registers is always available
  * for other parts of the module (e.g. I/O monitor needs it to intercept read/write operations of the PLC logic).
  * When the DR monitor is enabled, it mediates the access to DRs, so that they can be used only through this interface.
+ * In this case the available watchpoints are a pool shared by all the users of the interface:
+ * setting a DR claims a free slot, waiting for one if all of them are in use, and resetting it releases the slot.
+ * Since the DR monitor mediates each claim, its trusted state always includes the DRs set through the interface.
+ * Users can size their own concurrency on watch_dr_slots(). When the DR monitor is disabled,
+ * there is no pool and only one slot is assumed to be available.
+ * A context pointer is given to each DR, and it is available to the handler as 'bp->overflow_handler_context'.
  */
 
 typedef void (*dr_handler_t)(struct perf_event*, struct perf_sample_data*, struct pt_regs*);
 
-static inline void* __set_dr(int pid, void* vaddr, dr_handler_t handler, unsigned type) {
+// Return: the DR, or NULL if it cannot be set
+static inline void* __set_dr(int pid, void* vaddr, dr_handler_t handler, void* context, unsigned type) {
+	struct perf_event* __percpu* bp;
 	struct perf_event_attr attr;
 	hw_breakpoint_init(&attr);
 	attr.bp_addr = (unsigned long)vaddr;
@@ -48,41 +57,49 @@ static inline void* __set_dr(int pid, void* vaddr, dr_handler_t handler, unsigne
 	/*if (pid > 0) { // Not supported for now, requires re-enabling user side interface
 		tsk = pid_task(find_vpid(ppid), PIDTYPE_PID);
 		if (!tsk) return NULL;
-		return (void*)register_user_hw_breakpoint(&attr, handler, NULL, tsk);
+		return (void*)register_user_hw_breakpoint(&attr, handler, context, tsk);
 	}*/
-	return register_wide_hw_breakpoint(&attr, handler, NULL);
+	bp = register_wide_hw_breakpoint(&attr, handler, context);
+	return IS_ERR((void*)bp) ? NULL : (void*)bp;
 }
 
+// Same as unregister_wide_hw_breakpoint(), which goes through unregister_hw_breakpoint():
+// that one is patched out while the DR monitor is running (see dr_monitor.c), so events are released directly.
 static inline void __reset_dr(void* dr) {
-	if (dr) {
-		unregister_wide_hw_breakpoint((struct perf_event**)dr);
+	struct perf_event* __percpu* bp = dr;
+	int cpu;
+
+	if (bp) {
+		for_each_possible_cpu(cpu) {
+			if (per_cpu(*bp, cpu)) perf_event_release_kernel(per_cpu(*bp, cpu));
+		}
+		free_percpu(bp);
 	}
 }
 
 #ifdef DR_MONITOR_ENABLED
 
-#define DR_MONITOR_INTERVAL 	2000 // Monitor interval in microseconds
-#define DR_INTERVAL_ACCURACY	50 // Accuracy of each sleep in microseconds
-#define DR_MIN_RANGE(t)     	(t - DR_INTERVAL_ACCURACY)
-#define DR_MAX_RANGE(t)     	(t + DR_INTERVAL_ACCURACY)
+#define DR_MONITOR_INTERVAL 	2000 // Default monitor interval in microseconds (see dr_interval parameter)
 
 int start_dr_monitor(void);
 
 void stop_dr_monitor(void);
 
 // Debug registers interface
-void* set_read_dr(int pid, void* vaddr, dr_handler_t handler);
-void* set_write_dr(int pid, void* vaddr, dr_handler_t handler);
+void* set_read_dr(int pid, void* vaddr, dr_handler_t handler, void* context);
+void* set_write_dr(int pid, void* vaddr, dr_handler_t handler, void* context);
 void reset_dr(void*);
+unsigned watch_dr_slots(void);
 
 #else
 
 #define start_dr_monitor()   	0
 #define stop_dr_monitor()    	(void)0
 
-#define set_read_dr(p, v, h) 	__set_dr(p, v, h, HW_BREAKPOINT_R)
-#define set_write_dr(p, v, h)	__set_dr(p, v, h, HW_BREAKPOINT_W)
-#define reset_dr(d)          	__reset_dr(d)
+#define set_read_dr(p, v, h, c) 	__set_dr(p, v, h, c, HW_BREAKPOINT_R)
+#define set_write_dr(p, v, h, c)	__set_dr(p, v, h, c, HW_BREAKPOINT_W)
+#define reset_dr(d)             	__reset_dr(d)
+#define watch_dr_slots()        	1
 
 #endif
 
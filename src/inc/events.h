@@ -0,0 +1,90 @@
+#ifndef __EVENTS_H
+#define __EVENTS_H
+
+#include <linux/types.h>
+
+/*
+ * Detection events ring.
+ *
+ * Logging each detection with printk can stall the monitors: printk takes the console lock,
+ * and PLCs often have a slow serial console. Instead, each detection is written as a fixed-size binary record
+ * into a ring, without locks and without formatting, and userspace reads the records in place
+ * by mapping '/dev/ghostbuster' (read-only). Only a summary of the events is printed, at most once a second,
+ * and it can be disabled through the 'event_summary' parameter.
+ *
+ * The mapping starts with the ring header, followed by the records (at 'offset' bytes from the start).
+ * 'head' counts the records reserved so far, so record i is at index i % size (size is a power of two).
+ * Detections come from the monitor loop, from the verification work queue and from the syscall hooks,
+ * so there can be more producers at once: each one reserves its record by incrementing 'head' atomically.
+ * Each record has a sequence number, which is i + 1 once record i has been written, and 0 while it is being written.
+ * Readers never write into the ring, so any number of them can follow it, each one with its own position:
+ *   1) read the sequence number of record i: if it is not i + 1 yet, record i is not available;
+ *      if it is larger, record i has been overwritten, and the oldest available record is head - size;
+ *   2) copy the record;
+ *   3) read the sequence number again: if it has changed, the copy is not valid (overwritten meanwhile).
+ *
+ * This header is shared with userspace readers, which only need the definitions below.
+ */
+
+#define EVENT_DEVICE	"ghostbuster"
+#define EVENT_RECORDS	1024 // Number of records, power of two
+
+// Monitor
+#define GB_EVENT_IO 	0 // I/O configuration change: register address, old and new value
+#define GB_EVENT_DR 	1 // Debug register change: DR index, old and new state
+#define GB_EVENT_MAP	2 // I/O memory mapping request: physical address, virtual address (or error) and length
+
+// Verdict
+#define GB_VERDICT_PENDING   	0 // Verification deferred, the final verdict follows in another record
+#define GB_VERDICT_LEGITIMATE	1 // Accepted (for MAP, a mapping released)
+#define GB_VERDICT_ILLEGAL   	2 // Restored or denied (only logged by a passive monitor)
+
+typedef struct {
+	__u32 seq;      	// Sequence number: 0 while the record is being written
+	__u8 monitor;   	// GB_EVENT_*
+	__u8 verdict;   	// GB_VERDICT_*
+	__u16 cpu;      	// CPU of the detection (of the DR, for DR events)
+	__u64 time;     	// Monotonic time in nanoseconds (CLOCK_MONOTONIC)
+	__u64 target;   	// Target of the change (see monitors above)
+	__u64 old_value;	// Value before the change (trusted)
+	__u64 new_value;	// Value after the change
+	__s32 pid;      	// Requesting process for MAP events, 0 otherwise
+	__u32 reserved;
+} gb_event_t;
+
+typedef struct {
+	__u32 head;       	// Number of records reserved by writers
+	__u32 size;       	// Number of records
+	__u32 record_size;	// Size of each record in bytes
+	__u32 offset;     	// Offset of the first record in bytes
+	__u32 reserved[12];
+} gb_event_ring_t;
+
+#ifdef __KERNEL__
+
+#ifdef EVENT_RING
+
+int start_events(void);
+
+void stop_events(void);
+
+// Lock-free, safe to call from any context but NMI
+void record_event(unsigned monitor, unsigned verdict, unsigned cpu, u64 target, u64 old_value, u64 new_value, pid_t pid);
+
+// Per detection messages are left to the ring, but their arguments are still checked
+#define log_event(s, ...)     	do { if (0) log_info(s, ##__VA_ARGS__); } while (0)
+#define log_event_cont(s, ...)	do { if (0) log_cont(s, ##__VA_ARGS__); } while (0)
+
+#else
+
+#define start_events()                      	0
+#define stop_events()                       	(void)0
+#define record_event(m, v, c, t, o, n, p)   	(void)0
+#define log_event(s, ...)                   	log_info(s, ##__VA_ARGS__)
+#define log_event_cont(s, ...)              	log_cont(s, ##__VA_ARGS__)
+
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __INTENT_H
+#define __INTENT_H
+
+#include <linux/types.h>
+
+/*
+ * Intent channel between the PLC runtime and Ghostbuster.
+ *
+ * Observing the PLC logic through watchpoints is only a guess of what the runtime wants to do with a pin
+ * (see io_impl.h). A runtime willing to collaborate can declare its pin configuration changes in advance instead:
+ * it maps a page shared with Ghostbuster from '/dev/gb_intent', and writes the new mode of a pin there
+ * before writing the pin configuration registers. When the I/O monitor detects the change, it looks up
+ * the page without locks and accepts a matching change immediately, with no watchpoint and no sleep.
+ *
+ * The page is an array of entries, one for each pin. Each entry has a sequence number, which is odd
+ * while the runtime is writing the entry, and a mode. To declare a change, the runtime:
+ *   1) increments the sequence number (odd);
+ *   2) writes the new mode;
+ *   3) increments the sequence number (even);
+ *   4) writes the pin configuration register.
+ * A declared change is accepted once: the sequence number must change again for the next one.
+ * A declaration which is not used by a change within INTENT_TIMEOUT microseconds (up to twice as much,
+ * see the 'intent_timeout' parameter) expires, e.g. if the pin was already in the declared mode.
+ * Modes are implementation defined (e.g. the function select bits of the pin), and pin multiplexing
+ * changes are never accepted, even if declared.
+ *
+ * Only the PLC runtime process (the 'p_pid' parameter) can open and map the device:
+ * the owner of the page is decided by Ghostbuster at load time, and it cannot be changed.
+ * The mapping is not inherited by child processes.
+ *
+ * This header is shared with the PLC runtime, which only needs the definitions below.
+ */
+
+#define INTENT_DEVICE	"gb_intent"
+#define INTENT_PINS  	256
+
+typedef struct {
+	__u32 seq; // Sequence number: odd while the entry is being written
+	__u32 mode; // New mode of the pin
+} gb_intent_t;
+
+typedef struct {
+	gb_intent_t pins[INTENT_PINS];
+} gb_intent_page_t;
+
+#ifdef __KERNEL__
+
+#ifdef IO_INTENT
+
+#define INTENT_TIMEOUT	1000000 // Default expiry time of a declaration in microseconds (see intent_timeout parameter)
+
+int start_intent(int pid);
+
+void stop_intent(void);
+
+// Lock-free, to be called by a single task (the I/O monitor loop)
+int match_intent(unsigned pin, unsigned mode);
+
+#else
+
+#define start_intent(p)   	0
+#define stop_intent()     	(void)0
+#define match_intent(p, m)	0
+
+#endif
+
+#endif
+
+#endif
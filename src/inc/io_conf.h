@@ -1,14 +1,50 @@
 #ifndef __IO_CONF_H
 #define __IO_CONF_H
 
+// Policy classes of I/O registers
+#define IO_IGNORED   	0 // Not checked
+#define IO_IMMUTABLE 	1 // Any change is not legitimate
+#define IO_VERIFIABLE	2 // Changes are classified by the implementation (see classify_io_change)
+
+// Register to check into an I/O memory block.
+typedef struct {
+	unsigned offset; // Offset into the block in bytes
+	u32 mask; // Care mask: only these bits are checked
+	unsigned policy; // Policy class
+	unsigned width; // Access width in bytes (2 or 4)
+} io_reg_t;
+
 // I/O configuration to monitor, modeled as a set of I/O memory blocks.
 typedef struct {
 	const void** addrs; // Set of address blocks
 	const unsigned* sizes; // Size of each block in bytes
+	const unsigned* tiers; // Scan tier of each block (see below)
+	const io_reg_t* const* regs; // Registers to check of each block
+	const unsigned* reg_counts; // Number of registers to check of each block
 	const unsigned blocks; // Number of blocks
 	const unsigned size; // Total size
 } io_conf_t;
 
+/*
+ * Scan plan.
+ * At startup, the registers declared by the implementation are compiled into a flat array of entries,
+ * grouped by tier, each one with everything needed to check the register: the monitor loop
+ * goes through consecutive entries, instead of walking the blocks and computing masks for each word.
+ * Registers with an empty care mask, or ignored, are left out of the plan, so they cost nothing,
+ * and bits outside the care mask (e.g. reserved bits) never produce a detection.
+ * The trusted value of each register lives in its entry, and it is the one to update or restore.
+ */
+typedef struct {
+	volatile void* addr; // Register address (virtual)
+	u32 trusted; // Trusted value
+	u32 mask; // Care mask, never 0
+	u32 pending; // Bits under verification (see mark_io_pending)
+	unsigned char policy; // IO_IMMUTABLE or IO_VERIFIABLE
+	unsigned char block; // Index of the block
+	unsigned char width; // Access width in bytes (2 or 4)
+	unsigned short offset; // Offset into the I/O state in bytes
+} io_scan_t;
+
 // Information about I/O change detection
 typedef struct {
 	void* target;     	// Target address
@@ -53,6 +89,18 @@ extern void handle_io_detection(io_detect_t*);
  */
 #define PHYS_IO_CONF	((const io_conf_t*)&phys_io_conf)
 
+/*
+ * Scan tiers.
+ * Registers most exposed to Pin Control Attack (pin multiplexing and configuration) are checked on each scan period,
+ * while secondary control registers (e.g. event detect, pull-up/down) can be checked every few periods,
+ * so that the coverage grows without growing the cost of each period.
+ * Each block belongs to one tier, and each tier is checked by its own scheduler check, with its own
+ * interval and cost accounting (see scheduler.h). check_io_state() is called by the check of the block tier.
+ */
+#define IO_TIER_CRITICAL 	0
+#define IO_TIER_SECONDARY	1
+#define IO_TIERS         	2
+
 /*
  * The implementation should define the size (in bytes) needed to store the entire I/O configuration memory.
  * This size will be used by the monitor to allocate the necessary space.
@@ -70,25 +118,118 @@ extern void handle_io_detection(io_detect_t*);
 static inline void get_io_state(volatile void** addrs, void* state);
 
 /*
- * Iterate over the addresses of each I/O block to compare the current state in I/O memory with the trusted one.
+ * The implementation must declare the registers to check into each block (io_conf->regs), with their care mask,
+ * policy class and access width, in the same header file as the I/O configuration. Registers not declared are not checked.
+ * The trusted value of each register is taken from the state read by get_io_state() at startup, at its offset.
+ *
+ * Iterate over the entries of the scan plan (see above) to compare the current state in I/O memory with the trusted one.
  * This interface allows the implementation to decide size and alignment of each I/O memory access
  * as required by the specific architecture reference manual, thus optimizing the code.
- * Different I/O blocks may contain I/O registers with different sizes, requiring different access types.
- * The access type may vary according to which block is accessed; therefore, the implementation may need
- * to know which is the specified block (@index). The @index also allows it to get the size of the block,
- * which doesn't need to be passed as argument (io_conf->io_sizes[index]).
+ * Different I/O blocks may contain I/O registers with different sizes, requiring different access types:
+ * the block (@block) and the access width (@width) of each entry are known. The trusted value of a 16-bit
+ * register is kept in the lowest bits of @trusted, and it is saved into 2 bytes of the I/O state.
+ * Only the bits in the care mask and not pending must be compared.
  * For each detected change the implementation should fill detect_info_t and notify handle_io_detection().
  * The information contained into detect_info_t must be enough to eventually restore the trusted state later.
  *
- * @block: the block base address (virtual)
- * @state: the trusted state base address, relative to this block
- * @index: the index of the block, that is, the position inside io_conf->addrs
+ * @plan: the first entry to check
+ * @count: the number of entries to check
  */
-static inline void check_io_state(volatile void* block, const void* state, unsigned index);
+static inline void check_io_state(io_scan_t* plan, unsigned count);
 
 /*
- * Verify whether an I/O configuration change is legitimate or not.
+ * Generated backends.
+ * Instead of writing the tables above and the two scan functions by hand, the implementation may describe
+ * its registers (blocks, width, care mask, policy, pins) in a file named "io_regs.desc" in the model directory.
+ * At build time tools/gen_io.py turns it into "io_gen_defs.h", with the I/O configuration (to be included
+ * by "io_defs.h"), and "io_gen.h", with get_io_state() and check_io_state() unrolled for each register:
+ * constant masks, the right access width, and no loops over blocks or registers.
+ * The generated check_io_state() relies on the entries of each tier being in declaration order
+ * (as the monitor compiles them), and it calls the following handlers for each changed register,
+ * which must be defined by the implementation before including "io_gen.h":
+ *
+ * static inline void check_immutable_change(io_scan_t* e, u32 value, u32 diff);
+ * static inline void check_verifiable_change(io_scan_t* e, u32 value, u32 diff, unsigned first_pin);
+ *
+ * @e: the entry of the changed register
+ * @value: the current value of the register
+ * @diff: the changed bits, in the care mask and not pending (never 0)
+ * @first_pin: global number of the first pin of the register (see "pins=" in the description)
+ */
+
+/*
+ * The implementation should define the size (in bytes) of the extra target info pointed by io_detect_t.
+ * Detections needing a verification are handled asynchronously: the monitor copies both io_detect_t
+ * and its target info into a per-detection context, since check_io_state() is free to reuse its own buffers.
+ */
+#define IO_TARGET_INFO_SIZE	__IO_TARGET_INFO_SIZE
+
+/*
+ * Classify an I/O configuration change without blocking.
+ * This is called by the monitor loop for each detection, so it must return immediately.
  * In case of pin multiplexing, it should be considered always not legitimate.
+ * When the decision requires observing the PLC logic for some time (e.g. pin configuration),
+ * and the learned profile (see below) has no answer for the changed pin,
+ * the implementation should return UNDECIDED: the change will be verified later by is_legitimate(),
+ * outside of the monitor loop, which keeps scanning the other registers in the meantime.
+ * A LEGITIMATE change must be recorded into the target info as is_legitimate() does.
+ *
+ * @info: detection info pointer, as filled in by check_io_state()
+ *
+ * Return: LEGITIMATE or NOT_LEGITIMATE if a verdict is already available, UNDECIDED otherwise.
+ */
+
+#define NOT_LEGITIMATE      	0
+#define LEGITIMATE          	1
+#define UNDECIDED           	2
+#define PARTIALLY_LEGITIMATE	3 // Only some of the changes in a batch (see below)
+static inline int classify_io_change(io_detect_t* info);
+
+/*
+ * Describe a change as the PLC runtime would declare it through the intent channel (see intent.h):
+ * the global number of the changed pin, and its new mode. A change matching the declaration is accepted
+ * without calling classify_io_change(): accept_io_change() must record it as legitimate, as is_legitimate() does.
+ * Called by the monitor loop for each detection.
+ *
+ * @info: detection info pointer, as filled in by check_io_state()
+ * @pin: where to store the pin number
+ * @mode: where to store the new mode
+ *
+ * Return: 0 if the change cannot be declared (e.g. pin multiplexing, which is never legitimate), 1 otherwise.
+ */
+static inline int io_change_intent(io_detect_t* info, unsigned* pin, unsigned* mode);
+static inline void accept_io_change(io_detect_t* info);
+
+/*
+ * UNDECIDED changes are verified in batches: changes observed through the same
+ * verification window (e.g. pins of the same register watched by the same debug register)
+ * are judged together, instead of paying one window for each change.
+ * The implementation should return the same key for changes that can share a verification.
+ * While a batch is waiting for its verification to start, further changes with the same key are merged into it.
+ * Both functions are called by the monitor loop, merge_io_change() with the monitor commit lock held.
+ *
+ * @batch: detection info of the batch, as copied by the monitor into the verification context
+ * @info: detection info pointer, as filled in by check_io_state()
+ */
+static inline unsigned long io_verify_key(io_detect_t* info);
+static inline void merge_io_change(io_detect_t* batch, io_detect_t* info);
+
+/*
+ * Mark (or unmark) the target of an UNDECIDED change as pending verification.
+ * While pending, check_io_state() must ignore the bits changed by @info, so that the same change
+ * is not detected again on each scan. Any other bit of the same register is still checked.
+ * The trusted state is not modified here: the speculative new value is committed by update_io_state()
+ * only once the verdict arrives, otherwise the trusted value is restored.
+ * Both functions are called with the monitor commit lock held.
+ *
+ * @info: detection info pointer, as copied by the monitor into the verification context
+ */
+static inline void mark_io_pending(io_detect_t* info);
+static inline void clear_io_pending(io_detect_t* info);
+
+/*
+ * Verify whether an UNDECIDED I/O configuration change is legitimate or not.
+ * This function runs in the verification work queue, so it is allowed to sleep.
  * In caso of pin configuration, it should be considered legitimate only if subsequent accesses to the pin
  * made by the PLC logic are conforming with the new configuration.
  * For any other configuration register (e.g. event detect, pull-up/down, etc.) it is implementation defined
@@ -99,20 +240,24 @@ static inline void check_io_state(volatile void* block, const void* state, unsig
  * The implementation may need to know the PID and the virtual address used by the PLC runtime in order to
  * intercept read/write operations.
  *
- * @info: detection info pointer, as filled in by check_io_state()
+ * A batch gets a verdict for each of its changes: the implementation records which changes are legitimate
+ * into its target info, so that update_io_state() and restore_io_state() apply only to the right ones.
+ *
+ * @info: detection info pointer of the batch
  * @pid: PID of the running PLC runtime
  * @vaddr: virtual base address of the pin controller in use by the PLC runtime
  *
- * Return: LEGITIMATE if change is considered legitimate, NOT_LEGITIMATE otherwise.
+ * Return: LEGITIMATE if all the changes are considered legitimate, NOT_LEGITIMATE if none is,
+ *         PARTIALLY_LEGITIMATE otherwise.
  */
 
-#define NOT_LEGITIMATE  	0
-#define LEGITIMATE      	1
 static inline int is_legitimate(io_detect_t* info, int pid, void* vaddr);
 
 /*
  * Update the trusted I/O configuration to reflect the new legitimate state.
  * When a change is legitimate, the I/O monitor needs to update its trusted state with the new one.
+ * Only the changes recorded as legitimate are applied (see is_legitimate).
+ * The implementation may also record them into the learned profile (see below).
  *
  * @info: detection info pointer, as filled in by check_io_state()
  */
@@ -120,19 +265,44 @@ static inline void update_io_state(io_detect_t* info);
 
 /*
  * Restore the I/O memory to its trusted state.
- * detect_info_t contains an extra opaque pointer (@target_info) which can be managed (allocated and freed)
- * by the specific implementation, in order to apply the correct access type needed by the target address.
- * The target_info opaque pointer will not be used by the monitor after a call to restore_io_state(), so it must be freed here.
+ * io_detect_t contains an extra opaque pointer (@target_info), set by the specific implementation
+ * to apply the correct access type needed by the target address. It points to storage owned by the implementation
+ * (or to the copy kept by the monitor for asynchronous verifications, see IO_TARGET_INFO_SIZE), so it must not be freed here.
+ * Since a verdict may arrive long after the detection, the implementation should restore only the changed bits,
+ * reading the current value again instead of relying on @new_val.
+ * Changes recorded as legitimate (see is_legitimate) must be left untouched.
  *
  * @info: detection info pointer, as filled in by check_io_state()
  */
 static inline void __restore_io_state(io_detect_t* info);
 
+/*
+ * Learning mode.
+ * Instead of observing the PLC logic from scratch for each change, the implementation may profile
+ * how the logic uses each pin at runtime (e.g. its I/O direction), so that later changes can be classified
+ * in constant time by classify_io_change(). Changes involving pins that have not been profiled are still UNDECIDED.
+ * The monitor runs a learning phase at startup, and again on request (e.g. after each PLC logic upload).
+ *
+ * The learning phase is split into IO_LEARN_STEPS independent observations (0 if not supported),
+ * run concurrently in the verification work queue. While learning, the previous profile must not be used.
+ * begin_io_learning() and end_io_learning() are called with the monitor commit lock held,
+ * before the first step and after the last one.
+ *
+ * @step: the observation to run, in [0, IO_LEARN_STEPS)
+ * @pid: PID of the running PLC runtime
+ * @vaddr: virtual base address of the pin controller in use by the PLC runtime
+ * @state: the trusted state, i.e. the configuration the profile refers to
+ */
+#define IO_LEARN_STEPS	__IO_LEARN_STEPS
+static inline void begin_io_learning(void);
+static inline void learn_io_step(unsigned step, int pid, void* vaddr);
+static inline void end_io_learning(const void* state);
+
 #ifdef IO_MONITOR_ACTIVE
 
-#define restore_io_state(x)  	do {     	\
-	__restore_io_state(x);           	\
-	log_info("I/O state restored\n");	\
+#define restore_io_state(x)  	do {      	\
+	__restore_io_state(x);            	\
+	log_event("I/O state restored\n");	\
 } while(0)
 
 #else
@@ -20,7 +20,7 @@ static void __dump_io_state(volatile void* state) {
 	unsigned i, b, size, offset;
 	for (b = 0, offset = 0; b < PHYS_IO_CONF->blocks; b++) { // For each block
 		size = PHYS_IO_CONF->sizes[b]; // Current block size
-		log_info("\tAddress 0x%08lx (%u bytes):", (long)PHYS_IO_CONF->addrs[b], size);
+		log_info("\tAddress 0x%08lx (%u bytes):", IO_BLOCK_PHYS(PHYS_IO_CONF, b), size);
 		for (i = 0; i < size; i++) {
 			if (i % MAX_BYTES_PER_LINE == 0) {
 				log_cont("\n");
@@ -40,6 +40,7 @@ static void __dump_io_current_state(volatile void** addrs) {
 #define dump_io_state() do {                  	\
 	log_info("--- Start I/O dump ---\n"); 	\
 	log_info("I/O trusted state:\n");     	\
+	save_trusted_state();                 	\
 	__dump_io_state((void*)trusted_state);	\
 	log_info("I/O current state:\n");     	\
 	__dump_io_current_state(addrs);       	\
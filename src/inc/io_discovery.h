@@ -0,0 +1,44 @@
+#ifndef __IO_DISCOVERY_H
+#define __IO_DISCOVERY_H
+
+/*
+ * Discovery of the pin controller at load time.
+ *
+ * The I/O blocks of each model (see io_conf.h) are declared at their physical addresses, which are the same
+ * for the whole family of boards only if the peripherals are mapped at the same base. When they are not
+ * (e.g. BCM2835 at 0x20000000, BCM2836/BCM2837 at 0x3F000000), monitoring the static addresses means monitoring
+ * nothing at all. With discovery enabled (see Makefile), the pin controller is looked up in the device tree
+ * by its compatible string, and all the blocks are rebased on the address found there, keeping their layout.
+ *
+ * The implementation must provide "io_dt.h", defining:
+ *   - IO_DT_COMPATIBLE: compatible string of the pin controller node;
+ *   - IO_DT_BASE: physical address of the node assumed by the static I/O configuration;
+ *   - IO_DT_SPAN: bytes of the node used by the static I/O configuration, from IO_DT_BASE.
+ * All the blocks must lie into the node. A board without the node keeps the static configuration,
+ * while a node which is disabled, too small or not matching the static layout makes the load fail.
+ *
+ * Only the physical addresses change: blocks are mapped once at startup, and the scan itself is the same.
+ */
+
+#ifdef IO_DISCOVERY
+
+extern unsigned long io_base_offset; // Discovered base - static base
+
+// Look up the pin controller, before starting the monitors
+int discover_io_base(void);
+
+// Validate the static I/O configuration against the discovered node
+int check_io_base(const void** addrs, const unsigned* sizes, unsigned blocks);
+
+#else
+
+#define io_base_offset          	0UL
+#define discover_io_base()      	0
+#define check_io_base(a, s, b)  	0
+
+#endif
+
+// Physical address of block @b of the I/O configuration @conf, as discovered
+#define IO_BLOCK_PHYS(conf, b)	((unsigned long)(conf)->addrs[b] + io_base_offset)
+
+#endif
@@ -34,6 +34,8 @@
  * with some protected I/O address. This interface is available also if I/O monitor is disabled.
  */
 
+#include "io_discovery.h"
+
 // Map overlap checking interface
 #define NOT_OVERLAPPING    	0
 #define OVERLAPPING        	1
@@ -41,10 +43,9 @@
 	unsigned i;                                                     	\
 	unsigned long b_start, b_end;                                   	\
 	for (i = 0; i < PHYS_IO_CONF->blocks; i++) {                    	\
-		b_start = (unsigned long)PHYS_IO_CONF->addrs[i];        	\
+		b_start = IO_BLOCK_PHYS(PHYS_IO_CONF, i);                	\
 		b_end = b_start + (unsigned long)PHYS_IO_CONF->sizes[i];	\
-		if ( (start >= b_start && start <= b_end) ||            	\
-		     (end >= b_start && end <= b_end) )                 	\
+		if (start <= b_end && end >= b_start) /* Also covering it */	\
 			return OVERLAPPING;                             	\
 	}                                                               	\
 	return NOT_OVERLAPPING;                                         	\
@@ -53,13 +54,14 @@
 
 #ifdef IO_MONITOR_ENABLED
 
-#define IO_MONITOR_INTERVAL 	2000 // Monitor interval in microseconds
-#define IO_INTERVAL_ACCURACY	50 // Accuracy of each sleep in microseconds
-#define IO_MIN_RANGE(t)     	(t - IO_INTERVAL_ACCURACY)
-#define IO_MAX_RANGE(t)     	(t + IO_INTERVAL_ACCURACY)
+#define IO_MONITOR_INTERVAL 	2000 // Default monitor interval in microseconds (see io_interval parameter)
+#define IO_SECONDARY_INTERVAL	20000 // Default interval of secondary registers in microseconds (see io_secondary_interval parameter)
 
 int start_io_monitor(int, void*);
 
+// Start the learning phase at startup, after the DR monitor (see io_learn parameter).
+void start_io_learning(void);
+
 void stop_io_monitor(void);
 
 // Map interface delegated to I/O monitor.
@@ -68,16 +70,30 @@ int map_overlaps_io(unsigned long start, unsigned long end);
 #else
 
 #define start_io_monitor(x,y)	0
+#define start_io_learning()  	(void)0
 #define stop_io_monitor()    	(void)0
 
 // Include only basic I/O configuration to provide map interface.
+typedef struct {
+	unsigned offset; // Offset into the block in bytes
+	u32 mask; // Care mask
+	unsigned policy; // Policy class
+	unsigned width; // Access width in bytes
+} io_reg_t;
 typedef struct {
 	const void** addrs; // Set of address blocks
 	const unsigned* sizes; // Size of each block in bytes
+	const unsigned* tiers; // Scan tier of each block
+	const io_reg_t* const* regs; // Registers to check of each block
+	const unsigned* reg_counts; // Number of registers to check of each block
 	const unsigned blocks; // Number of blocks
 	const unsigned size; // Total size
 } io_conf_t;
 #define PHYS_IO_CONF	((const io_conf_t*)&phys_io_conf)
+#define IO_TIER_CRITICAL 	0
+#define IO_TIER_SECONDARY	1
+#define IO_IMMUTABLE     	1
+#define IO_VERIFIABLE    	2
 #include "io_defs.h"
 
 static inline int map_overlaps_io(unsigned long start, unsigned long end) {
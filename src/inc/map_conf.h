@@ -62,9 +62,11 @@ typedef asmlinkage void (*free_maps_t)(int);
  * @hooks: set of function pointers to replace syscalls with (in the order: mmap2, mremap, remap_file_pages, munmap)
  * @addrs: set of function pointers to store original syscalls into
  * @fm: a function pointer to the free_maps callback
+ *
+ * Return: 0 if the hooks are queued into the current patch transaction (see patch.h), an error code otherwise
  */
 
-static void hook_map_syscalls(void** hooks, void** addrs, free_maps_t fm);
+static int hook_map_syscalls(void** hooks, void** addrs, free_maps_t fm);
 
 /*
  * Determines whether the current mapping request is targeting physical memory or not.
@@ -87,9 +89,9 @@ static void restore_map_syscalls(void);
 
 #ifdef MAP_MONITOR_ACTIVE
 
-#define deny_mapping(r) do {                                         	\
-	log_cont("... denied\n");                                    	\
-	r = -EPERM;                                                  	\
+#define deny_mapping(r) do {                                                	\
+	log_event_cont("... denied\n");                                     	\
+	r = -EPERM;                                                         	\
 } while(0)
 
 #define handle_mmap(r, m, ...)    	deny_mapping(r)
@@ -98,22 +100,22 @@ static void restore_map_syscalls(void);
 
 #else
 
-#define handle_mmap(r, m, ...) do {                                  	\
-	r = m(__VA_ARGS__);                                          	\
-	if (IS_ERR_VALUE(r)) log_cont("... failed (%ld)\n", (long)r);	\
-	else log_cont("... mapped to %08lx\n", r);                   	\
+#define handle_mmap(r, m, ...) do {                                         	\
+	r = m(__VA_ARGS__);                                                 	\
+	if (IS_ERR_VALUE(r)) log_event_cont("... failed (%ld)\n", (long)r); 	\
+	else log_event_cont("... mapped to %08lx\n", r);                    	\
 } while(0)
 
-#define handle_mremap(r, m, ...) do {                                	\
-	r = m(__VA_ARGS__);                                          	\
-	if (IS_ERR_VALUE(r)) log_cont("... failed (%ld)\n", (long)r);	\
-	else log_cont("... remapped to 0x%08lx\n", r);               	\
+#define handle_mremap(r, m, ...) do {                                       	\
+	r = m(__VA_ARGS__);                                                 	\
+	if (IS_ERR_VALUE(r)) log_event_cont("... failed (%ld)\n", (long)r); 	\
+	else log_event_cont("... remapped to 0x%08lx\n", r);                	\
 } while(0)
 
-#define handle_remap_fp(r, m, a, ...) do {                           	\
-	r = m(a, __VA_ARGS__);                                       	\
-	if (r) log_cont("... failed (%ld)\n", (long)r);              	\
-	else log_cont("... mapped to %08lx\n", a);                   	\
+#define handle_remap_fp(r, m, a, ...) do {                                  	\
+	r = m(a, __VA_ARGS__);                                              	\
+	if (r) log_event_cont("... failed (%ld)\n", (long)r);               	\
+	else log_event_cont("... mapped to %08lx\n", a);                    	\
 } while(0)
 
 #endif
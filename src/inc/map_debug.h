@@ -3,7 +3,7 @@
 
 #include "log.h"
 
-#include <linux/list.h>
+#include <linux/hashtable.h>
 
 /*
  * MAP debug subsystem.
@@ -14,27 +14,23 @@
 
 #ifdef MAP_DEBUG // MAP debug subsystem enabled
 
-static void __dump_map_state(struct list_head* head) {
-	struct list_head* pos;
-	page* cur;
-	if (list_empty(head)) {
-		log_info("List of active '/dev/mem' mappings is empty.\n");
+static void __dump_map_state(void) {
+	unsigned bkt;
+	mapping* cur;
+	if (hash_empty(map_table)) {
+		log_info("Table of active '/dev/mem' mappings is empty.\n");
 	} else {
-		log_info("List of active '/dev/mem' mappings:\n");
-		list_for_each(pos, head) {
-			cur = list_entry(pos, page, pages);
-			log_info("\tphys[0x%08lx] -> virt[0x%08lx] (pid %d)\n", cur->paddr, cur->vaddr, cur->pid);
-			if (pos->next != head) {
-				log_info("\t                      |\n");
-				log_info("\t                      v\n");
-			}
+		log_info("Table of active '/dev/mem' mappings:\n");
+		hash_for_each(map_table, bkt, cur, node) {
+			log_info("\t[%02u] phys[0x%08lx - 0x%08lx] -> virt[0x%08lx - 0x%08lx] (pid %d)\n",
+			         bkt, cur->paddr, cur->paddr + cur->len, cur->vaddr, mapping_end(cur), cur->pid);
 		}
 	}
 }
 
 #define dump_map_state() do {                	\
 	log_info("--- Start MAP dump ---\n");	\
-	__dump_map_state(&page_list);        	\
+	__dump_map_state();                  	\
 	log_info("--- End MAP dump ---\n");  	\
 } while (0)
 
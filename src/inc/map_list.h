@@ -1,67 +1,93 @@
 #ifndef __MAP_LIST_H
 #define __MAP_LIST_H
 
-#include <linux/list.h>
+#include <linux/hashtable.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 
 // Information about I/O mapping requests detected.
 // An I/O mapping is detected by checking whether the requested block overlaps
 // with at least one of the blocks defined by the I/O monitor.
-// Mappings are stored and handled at the page level.
-// Each detected mapped page contains the physical address, the virtual address
-// and the pid of the process who has requested the mapping.
+// Mappings are stored and handled as extents, i.e. ranges of contiguous pages.
+// Each detected mapping contains the physical address, the virtual address and the length
+// of the range, and the pid of the process who has requested the mapping.
 typedef struct {
-	struct list_head pages; // List of current mappings under detection
+	struct hlist_node node; // Node of the bucket of the owner process
 	unsigned long paddr; // The start physical address requested
 	unsigned long vaddr; // The virtual address the request has been mapped into
+	unsigned long len; // Length of the range (multiple of PAGE_SIZE)
 	pid_t pid; // The process who has requested the mapping
-} page;
-
-// Mapped pages are stored into a global list (@page_list).
-// We assume that the number of processes normally interested in I/O mappings is quite low,
-// so a global list containing mapped pages of these processes together performs well enough.
-// If that is not the case, this data structure could be improved (e.g. by using hashtable based on process ids).
-LIST_HEAD(page_list); // struct list_head page_list = ...;
-DEFINE_MUTEX(page_list_lock); // To protect the list from concurrent accesses
+} mapping;
+
+#define mapping_end(m)	((m)->vaddr + (m)->len)
+
+// Mappings are stored into a hashtable keyed by process id (@map_table), so
+// all the mappings of a process are in the same bucket, and looking up an address
+// only goes through the (few) mappings of that process, and of the processes that share the bucket.
+// A large '/dev/mem' mapping is a single node, however many pages it spans.
+//
+// Hooked syscalls look up every mremap, munmap and remap_file_pages of the whole system,
+// while only a few processes have '/dev/mem' mappings. Each bucket has a counter of its mappings,
+// which is read without locks: if it is zero, the calling process has no mappings for sure,
+// and the lock is not taken at all. This is safe because mappings of a process are only added
+// by the process itself (the counter is updated before its syscall returns), while removing them concurrently
+// (exit notifier) can only turn a positive answer into a negative one, which the slow path handles anyway.
+// Counters are per bucket rather than per process, so a collision only costs a slow lookup.
+#define MAP_HASH_BITS	8 // 256 buckets
+
+DEFINE_HASHTABLE(map_table, MAP_HASH_BITS);
+static atomic_t map_count[1 << MAP_HASH_BITS]; // Mappings in each bucket
+// The exit probe (see map_impl.h) runs with preemption disabled, so nothing sleeps while holding the lock:
+// nodes are allocated before taking it.
+static DEFINE_SPINLOCK(map_table_lock); // To protect the table from concurrent accesses
 
 #include "map_debug.h"
 
-#define add_page(p)          	list_add_tail(&((p)->pages), &page_list)
-#define add_page_after(p, h) 	list_add(&((p)->pages), &((h)->pages))
-#define add_page_before(p, h)	list_add_tail(&((p)->pages), &((h)->pages))
-#define del_page(p)          	list_del(&((p)->pages))
-#define next_page(p)         	list_entry((p)->pages.next, page, pages)
-
-// Mutex already held by the caller
-static inline page* find_page_by_paddr(unsigned long paddr, pid_t pid) {
-	struct list_head* pos;
-	page* cur;
-	list_for_each(pos, &page_list) {
-		cur = list_entry(pos, page, pages);
-		if (cur->pid == pid && cur->paddr == paddr)
+#define map_bucket(pid)	hash_min(pid, MAP_HASH_BITS)
+
+// Lock already held by the caller
+static inline void add_extent(mapping* m) {
+	hash_add(map_table, &m->node, m->pid);
+	atomic_inc(&map_count[map_bucket(m->pid)]);
+}
+
+// Lock already held by the caller
+static inline void del_extent(mapping* m) {
+	hash_del(&m->node);
+	atomic_dec(&map_count[map_bucket(m->pid)]);
+}
+
+// Lock-free, see above
+#define has_mappings(pid)	(atomic_read(&map_count[map_bucket(pid)]) != 0)
+
+// Lock already held by the caller
+static inline mapping* find_mapping(unsigned long vaddr, pid_t pid) {
+	mapping* cur;
+	hash_for_each_possible(map_table, cur, node, pid) {
+		if (cur->pid == pid && vaddr >= cur->vaddr && vaddr < mapping_end(cur))
 			return cur;
 	}
 	return NULL;
 }
 
-// Mutex already held by the caller
-static inline page* find_page_by_vaddr(unsigned long vaddr, pid_t pid) {
-	struct list_head* pos;
-	page* cur;
-	list_for_each(pos, &page_list) {
-		cur = list_entry(pos, page, pages);
-		if (cur->pid == pid && cur->vaddr == vaddr)
-			return cur;
+static inline mapping* alloc_extent(unsigned long paddr, unsigned long vaddr, unsigned long len, pid_t pid) {
+	mapping* m = kmalloc(sizeof(mapping), GFP_KERNEL);
+	if (m) {
+		m->paddr = paddr;
+		m->vaddr = vaddr;
+		m->len = len;
+		m->pid = pid;
 	}
-	return NULL;
+	return m;
 }
 
 /*
- * Invariant: pages belonging to the same mapped block are contiguous inside page_list.
- * Thus, contiguous virtual pages are contiguous into our list as well.
- * This includes also the case when mremap "splits" a mapped block in two parts,
- * creating a hole in virtual address space. The situation is represented below:
+ * Invariant: mappings of the same process never overlap in virtual address space.
+ * Before storing a new mapping, its virtual range is punched out of the existing ones
+ * (as the kernel does when a new mapping replaces an old one). This includes also the case when mremap
+ * "splits" a mapped block in two parts, creating a hole in virtual address space.
+ * The situation is represented below:
  *
  *               physical memory               virtual memory
  *               |            |                |            |
@@ -73,158 +99,153 @@ static inline page* find_page_by_vaddr(unsigned long vaddr, pid_t pid) {
  *               |            |    |           |------------|
  *               |            |    |   (2)     |            |
  *               |            |    | mremap    |            |
- *               |            |    ----------> |------------| 0xce546000 
+ *               |            |    ----------> |------------| 0xce546000
  *               |            |                |------------|
  *               |            |                |            |
  *               |            |                |            |
  *               |            |                |            |
  *
- * (1) mmap() maps 4 pages starting from 0x20200000 into vmem -> 4 contiguous nodes into the list
- *                  __________     __________     __________     __________
- *     page_list:  |0xbf6e4000|-->|0xbf6e5000|-->|0xbf6e6000|-->|0xbf6e7000|
- *                 |__________|   |__________|   |__________|   |__________|
+ * (1) mmap() maps 4 pages starting from 0x20200000 into vmem -> 1 extent
+ *                  ______________
+ *     bucket:     |0xbf6e4000 (4)|
+ *                 |______________|
  *
  * (2) mremap() remaps 1 page starting from 0x20202000 into a different vmem address,
- *     producing a hole in the previous mapping. The result is having three different mapped blocks.
- *                  __________     __________     __________     __________
- *     page_list:  |0xbf6e4000|-->|0xbf6e5000|-->|0xce546000|-->|0xbf6e7000|
- *                 |__________|   |__________|   |__________|   |__________|
+ *     producing a hole in the previous mapping. The first extent is split,
+ *     and the result is having three different mapped blocks.
+ *                  ______________    ______________    ______________
+ *     bucket:     |0xbf6e4000 (2)|->|0xbf6e7000 (1)|->|0xce546000 (1)|
+ *                 |______________|  |______________|  |______________|
  *
+ * A punch can split at most one extent (the one containing the whole range, if any),
+ * so the caller provides a spare node for the second half, allocated in advance.
+ * The spare node is consumed (set to NULL) only if a split has happened.
+ * Lock already held by the caller.
  */
-static inline int add_mapping(unsigned long paddr, unsigned long len, unsigned long vaddr, pid_t pid) {
-	unsigned long pages;
-	unsigned i;
-	page* p;
+static inline void punch_mappings(unsigned long start, unsigned long end, pid_t pid, mapping** spare) {
+	struct hlist_node* tmp;
+	mapping *cur, *tail;
+
+	hash_for_each_possible_safe(map_table, cur, tmp, node, pid) {
+		if (cur->pid != pid || end <= cur->vaddr || start >= mapping_end(cur))
+			continue; // No overlap
+		if (start <= cur->vaddr && end >= mapping_end(cur)) { // Fully covered
+			del_extent(cur);
+			kfree(cur);
+		} else if (start <= cur->vaddr) { // Head covered
+			cur->paddr += end - cur->vaddr;
+			cur->len -= end - cur->vaddr;
+			cur->vaddr = end;
+		} else if (end >= mapping_end(cur)) { // Tail covered
+			cur->len = start - cur->vaddr;
+		} else { // Hole in the middle
+			tail = *spare;
+			*spare = NULL;
+			tail->paddr = cur->paddr + (end - cur->vaddr);
+			tail->vaddr = end;
+			tail->len = mapping_end(cur) - end;
+			tail->pid = pid;
+			cur->len = start - cur->vaddr;
+			add_extent(tail);
+		}
+	}
+}
+
+// Replace any mapping of the process in [vaddr, vaddr + len) with the given one
+static inline int store_mapping(unsigned long paddr, unsigned long len, unsigned long vaddr, pid_t pid) {
+	mapping *m, *spare;
 	int res = 0;
 
-	pages = len / PAGE_SIZE;
-	mutex_lock(&page_list_lock);
-	for (i = 0; i < pages; i++, paddr += PAGE_SIZE, vaddr += PAGE_SIZE) {
-		// If the page is already mapped for the process
-		// the old mapping is overwritten (as mmap2 does).
-		// Otherwise allocate a new page.
-		if (!(p = find_page_by_vaddr(vaddr, pid))) {
-			p = kmalloc(sizeof(page), GFP_KERNEL);
-			if (!p) {
-				res = -ENOMEM;
-				goto unlock_and_return;
-			}
-		}
-		p->paddr = paddr;
-		p->vaddr = vaddr;
-		p->pid = pid;
-		add_page(p);
+	// Allocate before locking: at most one node for the new extent and one for a split
+	m = alloc_extent(paddr, vaddr, len, pid);
+	spare = kmalloc(sizeof(mapping), GFP_KERNEL);
+	if (!m || !spare) {
+		res = -ENOMEM;
+		goto free_and_return;
 	}
 
-unlock_and_return:
+	spin_lock(&map_table_lock);
+	punch_mappings(vaddr, vaddr + len, pid, &spare);
+	add_extent(m);
+	m = NULL;
 	dump_map_state();
-	mutex_unlock(&page_list_lock);
+	spin_unlock(&map_table_lock);
+
+free_and_return:
+	kfree(spare);
+	kfree(m);
 	return res;
 }
 
+// If the range is already mapped for the process
+// the old mapping is overwritten (as mmap2 does).
+static inline int add_mapping(unsigned long paddr, unsigned long len, unsigned long vaddr, pid_t pid) {
+	return store_mapping(paddr, len, vaddr, pid);
+}
+
 static inline unsigned long get_mapped_phys(unsigned long vaddr, pid_t pid) {
 	unsigned long paddr = 0;
-	page* p;
+	mapping* m;
+
+	if (likely(!has_mappings(pid))) return 0; // Fast path, most processes never map '/dev/mem'
 
-	mutex_lock(&page_list_lock);
-	p = find_page_by_vaddr(vaddr, pid);
-	if (p) paddr = p->paddr;
-	mutex_unlock(&page_list_lock);
+	spin_lock(&map_table_lock);
+	m = find_mapping(vaddr, pid);
+	if (m) paddr = m->paddr + (vaddr - m->vaddr);
+	spin_unlock(&map_table_lock);
 
 	return paddr;
 }
 
 static inline int update_mapping(unsigned long vaddr, unsigned long len, unsigned long new_vaddr, unsigned long new_len, unsigned long paddr, pid_t pid) {
-	unsigned long pages, new_pages, min_pages;
-	unsigned i;
-	page *p, *tmp;
-	int res = 0;
-
-	pages = len / PAGE_SIZE;
-	new_pages = new_len / PAGE_SIZE;
-	min_pages = min(pages, new_pages);
-
-	mutex_lock(&page_list_lock);
-	p = find_page_by_vaddr(vaddr, pid);
-	for (i = 0; i < min_pages; i++, new_vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
-		p->vaddr = new_vaddr;
-		p = next_page(p);
-	}
-	// delete exceeding pages...
-	for ( ; min_pages < pages; min_pages++) {
-		tmp = p;
-		p = next_page(p);
-		del_page(tmp);
-		kfree(tmp);
-	}
-	// ... or add missing ones
-	for ( ; min_pages < new_pages; min_pages++, new_vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
-		tmp = kmalloc(sizeof(page), GFP_KERNEL);
-		if (!tmp) {
-			res = -ENOMEM;
-			goto unlock_and_return;
-		}
-		tmp->paddr = paddr;
-		tmp->vaddr = new_vaddr;
-		add_page_before(tmp, p);
+	mapping* spare;
+
+	// The old range is released, unless it is resized in place
+	if (new_vaddr != vaddr || new_len < len) {
+		spare = kmalloc(sizeof(mapping), GFP_KERNEL);
+		if (!spare) return -ENOMEM;
+		spin_lock(&map_table_lock);
+		punch_mappings(vaddr, vaddr + len, pid, &spare);
+		spin_unlock(&map_table_lock);
+		kfree(spare);
 	}
+	return store_mapping(paddr, new_len, new_vaddr, pid);
+}
 
-unlock_and_return:
-	dump_map_state();
-	mutex_unlock(&page_list_lock);
-	return res;
+static inline int alter_mapping(unsigned long vaddr, unsigned long paddr, unsigned long len, pid_t pid) {
+	return store_mapping(paddr, len, vaddr, pid);
 }
 
-static inline void alter_mapping(unsigned long vaddr, unsigned long paddr, unsigned long len, pid_t pid) {
-	unsigned long pages = len / PAGE_SIZE;
-	unsigned i;
-	page* p;
+static inline int delete_mapping(unsigned long vaddr, unsigned long len, pid_t pid) {
+	mapping* spare;
 
-	mutex_lock(&page_list_lock);
-	p = find_page_by_vaddr(vaddr, pid);
-	for (i = 0; i < pages; i++, paddr += PAGE_SIZE) {
-		p->paddr = paddr;
-	}
-	dump_map_state();
-	mutex_unlock(&page_list_lock);
-}
+	spare = kmalloc(sizeof(mapping), GFP_KERNEL);
+	if (!spare) return -ENOMEM;
 
-static inline void delete_mapping(unsigned long vaddr, unsigned long len, pid_t pid) {
-	unsigned long pages;
-	unsigned i;
-	page *p, *tmp;
-
-	pages = len / PAGE_SIZE;
-
-	mutex_lock(&page_list_lock);
-	p = find_page_by_vaddr(vaddr, pid);
-	if (p) {
-		for (i = 0; i < pages; i++) {
-			tmp = p;
-			p = next_page(p);
-			del_page(tmp);
-			kfree(tmp);
-		}
+	spin_lock(&map_table_lock);
+	punch_mappings(vaddr, vaddr + len, pid, &spare);
+	dump_map_state();
+	spin_unlock(&map_table_lock);
 
-		dump_map_state();
-	}
-	mutex_unlock(&page_list_lock);
+	kfree(spare);
+	return 0;
 }
 
 static inline void clean_mappings(pid_t pid) {
-	struct list_head *pos, *tmp;
-	page* cur;
+	struct hlist_node* tmp;
+	mapping* cur;
 
-	mutex_lock(&page_list_lock);
-	list_for_each_safe(pos, tmp, &page_list) {
-		cur = list_entry(pos, page, pages);
+	if (likely(!has_mappings(pid))) return; // Fast path, see above
+
+	spin_lock(&map_table_lock);
+	hash_for_each_possible_safe(map_table, cur, tmp, node, pid) {
 		if (cur->pid == pid) {
-			del_page(cur);
+			del_extent(cur);
 			kfree(cur);
-		}	
+		}
 	}
 	dump_map_state();
-	mutex_unlock(&page_list_lock);
+	spin_unlock(&map_table_lock);
 }
 
 #endif
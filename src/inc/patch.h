@@ -0,0 +1,41 @@
+#ifndef __PATCH_H
+#define __PATCH_H
+
+/*
+ * Kernel patch transactions.
+ *
+ * Some monitors need to patch the kernel when they start and stop: the DR monitor replaces
+ * the user DR interface with stubs (kernel text), the MAP monitor hooks the mapping syscalls (syscall table).
+ * Each write must be done while no other CPU is running, i.e. inside stop_machine(), which also stalls
+ * the PLC scan cycle. Instead of stopping the machine once for each write, writes are queued
+ * into a transaction, and applied all together in a single stop_machine(), flushing only the patched ranges.
+ *
+ * A transaction is opened with begin_patches() and committed with end_patches(),
+ * which reports how long the machine has been stopped.
+ * Writes queued by a task with no open transaction (e.g. a monitor stopping itself at runtime)
+ * are committed immediately, as a transaction on their own.
+ * Buffers passed to queue_patch() must stay valid until the transaction is committed.
+ *
+ * A transaction is applied as a whole or not at all: if a write cannot be queued, or kernel text
+ * cannot be written safely, nothing is written and end_patches() returns the error.
+ */
+
+#define PATCH_MAX_ENTRIES	16 // Maximum number of writes in a transaction
+
+void begin_patches(void);
+
+// Return: 0 if the transaction has been applied, an error code otherwise
+int end_patches(void);
+
+/*
+ * Queue a write of @size bytes (multiple of 4) from @new_text to @addr.
+ * When the write is applied, the previous content of @addr is saved into @old_text, if not NULL.
+ *
+ * Return: 0 if queued (or committed), an error code otherwise
+ */
+int queue_patch(void* addr, const void* new_text, void* old_text, unsigned size);
+
+// Same as queue_patch(), for kernel data words (e.g. syscall table entries), which are never executed.
+int queue_data_patch(void* addr, const void* new_data, void* old_data, unsigned size);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __PATCH_CONF_H
+#define __PATCH_CONF_H
+
+
+/************************ Patch interface ************************/
+
+/*
+ * The following interface should be implemented by the architecture specific header.
+ * To optimize the code, all the functions must be defined as static inline.
+ *
+ * Writes are always applied inside stop_machine(), so the implementation does not need
+ * to synchronize with other CPUs, but it has to make the written words visible to instruction fetches.
+ */
+
+/*
+ * Prepare the patch implementation (e.g. look up kernel symbols).
+ * Called before each commit, outside of stop_machine().
+ *
+ * Return: 0 on success, an error code if kernel text cannot be written safely (the commit is discarded)
+ */
+static inline int init_patch(void);
+
+/*
+ * Write @count words from @words to @addr, with the machine stopped,
+ * and flush the patched range only.
+ *
+ * @addr: the kernel text address to patch
+ * @words: the words to write
+ * @count: number of words to write
+ */
+static inline void __patch_words(u32* addr, const u32* words, unsigned count);
+
+/*
+ * Write @count data words from @words to @addr (e.g. syscall table entries), with the machine stopped.
+ * The words are never executed, so no instruction cache is flushed, but they may be read-only as kernel text is.
+ */
+static inline void __patch_data(u32* addr, const u32* words, unsigned count);
+
+
+/*
+ * Include architecture-dependent patch header.
+ */
+
+#include "patch_impl.h"
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __SCAN_TIMER_H
+#define __SCAN_TIMER_H
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "log.h"
+
+/*
+ * Periodic wake-up of the scheduler task, which runs the monitor checks (see scheduler.h).
+ *
+ * Each monitor scans its resources once per interval, and the detection window of an attack
+ * depends on how precisely this interval is kept. Two backends are available, chosen at compile time (see Makefile):
+ *
+ *  - kthread: the task sleeps with usleep_range() after each scan. The sleep is relative to the end
+ *    of the scan, and the kernel is free to wake the task anywhere in the given range (plus timer slack),
+ *    so the actual period drifts and its jitter can be well above the requested accuracy.
+ *  - hrtimer (SCAN_HRTIMER): the task sleeps until an absolute hrtimer deadline with no slack.
+ *    The deadline is advanced by exactly one interval each time, so the scan time and the wake-up
+ *    latency are not accumulated, and the period stays precise. If a deadline is missed
+ *    (e.g. the scan took longer than the interval), the whole missed periods are skipped.
+ *
+ * In both cases the actual period, its jitter (distance from the requested interval) and the missed periods are recorded,
+ * and they are reported when the scheduler is stopped.
+ */
+
+typedef struct {
+	unsigned interval;   	// Requested interval in microseconds
+	unsigned accuracy;   	// Accuracy of each sleep in microseconds (kthread backend only)
+#ifdef SCAN_HRTIMER
+	ktime_t next;        	// Next absolute deadline
+#endif
+	unsigned long missed;	// Number of missed periods
+	ktime_t first, last; 	// First and last wake-up
+	unsigned long periods;	// Number of recorded periods
+	s64 min_period;      	// Shortest period in nanoseconds
+	s64 max_period;      	// Longest period in nanoseconds
+	u64 jitter_sum;      	// Sum of the jitter of each period in nanoseconds
+	s64 max_jitter;      	// Worst jitter in nanoseconds
+} scan_timer_t;
+
+static inline void init_scan_timer(scan_timer_t* t, unsigned interval, unsigned accuracy) {
+	t->interval = interval;
+	t->accuracy = accuracy;
+	t->first = t->last = ktime_get();
+#ifdef SCAN_HRTIMER
+	t->next = ktime_add_us(t->first, interval);
+#endif
+	t->missed = 0;
+	t->periods = 0;
+	t->min_period = S64_MAX;
+	t->max_period = 0;
+	t->jitter_sum = 0;
+	t->max_jitter = 0;
+}
+
+// The new interval is used from the next deadline on.
+// Jitter is measured against the new interval as well, while the average period
+// reported at the end is over the whole run.
+static inline void set_scan_interval(scan_timer_t* t, unsigned interval) {
+	t->interval = interval;
+}
+
+static inline void __record_scan_period(scan_timer_t* t) {
+	ktime_t now = ktime_get();
+	s64 period = ktime_to_ns(ktime_sub(now, t->last));
+	s64 jitter = period - (s64)t->interval * NSEC_PER_USEC;
+
+	if (jitter < 0) jitter = -jitter;
+	if (period < t->min_period) t->min_period = period;
+	if (period > t->max_period) t->max_period = period;
+	if (jitter > t->max_jitter) t->max_jitter = jitter;
+	t->jitter_sum += jitter;
+	t->periods++;
+	t->last = now;
+}
+
+#ifdef SCAN_HRTIMER
+
+static inline void wait_scan_timer(scan_timer_t* t) {
+	ktime_t now = ktime_get();
+
+	// Skip missed deadlines, keeping the original phase
+	while (ktime_compare(t->next, now) <= 0) {
+		t->next = ktime_add_us(t->next, t->interval);
+		t->missed++;
+	}
+
+	// The task may be woken up early (e.g. by kthread_stop()):
+	// in that case the deadline is kept for the next wait.
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!schedule_hrtimeout_range(&t->next, 0, HRTIMER_MODE_ABS))
+		t->next = ktime_add_us(t->next, t->interval);
+
+	__record_scan_period(t);
+}
+
+// Start a new period from now on, e.g. after an early wake-up.
+static inline void restart_scan_timer(scan_timer_t* t) {
+	t->next = ktime_add_us(ktime_get(), t->interval);
+}
+
+#else
+
+// With no deadlines, a period as long as two intervals or more has missed the whole intervals in excess.
+static inline void wait_scan_timer(scan_timer_t* t) {
+	ktime_t last = t->last;
+	s64 lost;
+
+	usleep_range(t->interval - t->accuracy, t->interval + t->accuracy);
+
+	__record_scan_period(t);
+	lost = div64_s64(ktime_to_ns(ktime_sub(t->last, last)), (s64)t->interval * NSEC_PER_USEC) - 1;
+	if (lost > 0) t->missed += lost;
+}
+
+#define restart_scan_timer(t)	(void)0
+
+#endif
+
+#define __ns_to_us(ns)	div_s64(ns, NSEC_PER_USEC)
+
+static inline void report_scan_timer(scan_timer_t* t, const char* name) {
+	s64 avg_period, avg_jitter;
+
+	if (!t->periods) return;
+	avg_period = div64_u64(ktime_to_ns(ktime_sub(t->last, t->first)), t->periods);
+	avg_jitter = div64_u64(t->jitter_sum, t->periods);
+	log_info("%s timer: %lu periods, period min/avg/max = %lld/%lld/%lld us, jitter avg/max = %lld/%lld us",
+	         name, t->periods,
+	         __ns_to_us(t->min_period), __ns_to_us(avg_period), __ns_to_us(t->max_period),
+	         __ns_to_us(avg_jitter), __ns_to_us(t->max_jitter));
+	log_cont(", %lu missed periods\n", t->missed);
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+#include <linux/moduleparam.h>
+
+/*
+ * Ghostbuster scheduler.
+ *
+ * Each monitor needs to periodically check its resources (e.g. I/O configuration memory or debug registers).
+ * Instead of having one task for each monitor, each one with its own sleep loop, a single task runs all the checks
+ * in the same wake-up. On a single-core target, which also runs the PLC scan cycle, this saves one wake-up,
+ * one context switch and one cache warm-up for each additional monitor and for each period.
+ *
+ * Monitors register their checks, each one with its own interval. The scheduler wakes up with a base period,
+ * which is the greatest common divisor of all the intervals, and runs each check every 'mult' base periods,
+ * where 'mult' is the period multiplier of the check (interval / base period).
+ * Checks are registered before starting the scheduler, and unregistered after stopping it.
+ * Intervals can be changed at any time through set_check_interval() (e.g. from module parameters):
+ * the new base period and multipliers take effect from the next wake-up.
+ *
+ * Checks can also be marked as adaptive. While the system is quiet, adaptive checks run with a slower interval
+ * (their own interval multiplied by the 'quiet_slowdown' parameter), lowering the steady-state CPU usage.
+ * Whenever a suspicious event is notified through sched_alert() (e.g. an overlapping mapping request,
+ * a DR change or an I/O change), all the checks go back to their own intervals for 'alert_hold' milliseconds,
+ * starting from an immediate wake-up. Thus, detection latency during an attack is not affected.
+ *
+ * The task runs with the default policy unless configured otherwise through module parameters, applied at start:
+ * either a real-time priority (SCHED_FIFO), or a CPU budget in each base period (SCHED_DEADLINE), so that PLC load
+ * cannot delay the checks past their period. The task can be bound to a CPU ('sched_cpu'), or kept off the CPU the PLC
+ * runtime is running on ('housekeeping'), so that on multi-core targets the checks do not compete with the scan cycle.
+ * The runtime is supposed to be bound to its core (e.g. isolcpus). Deadline tasks cannot have a restricted affinity,
+ * so SCHED_DEADLINE excludes both. Missed scan periods and overruns (wake-ups whose checks took longer than
+ * the base period) are exported as read-only parameters.
+ *
+ * When the scheduler is stopped, it reports how much CPU time each check has taken, and an estimate of the CPU time saved
+ * by running all the checks in the same wake-up, based on the measured overhead of a single wake-up.
+ */
+
+typedef struct {
+	struct list_head checks; 	// List of registered checks
+	const char* name;        	// Name of the check, for logging purposes
+	void (*check)(void);     	// Check callback, run by the scheduler task
+	unsigned interval;       	// Requested interval in microseconds
+	int adaptive;            	// Slow down while quiet (see above)
+	unsigned mult;           	// Period multiplier, set by the scheduler
+	unsigned countdown;      	// Base periods left before the next run
+	unsigned long runs;      	// Number of runs
+	u64 time;                	// Time spent in the check in nanoseconds
+} sched_check_t;
+
+#define SCHED_INTERVAL_ACCURACY	50 // Accuracy of each sleep in microseconds
+#define SCHED_MIN_INTERVAL     	100 // Minimum check interval in microseconds
+#define SCHED_MAX_INTERVAL     	1000000 // Maximum check interval in microseconds
+#define SCHED_MAX_SLOWDOWN     	100 // Maximum interval multiplier while quiet
+#define SCHED_DEFAULT_PRIORITY 	50 // SCHED_FIFO priority, as threaded interrupt handlers
+#define SCHED_DEFAULT_RUNTIME  	200 // SCHED_DEADLINE budget per base period in microseconds
+
+// The PLC runtime pid is needed to find a housekeeping CPU (see above).
+int start_scheduler(int runtime_pid);
+
+void stop_scheduler(void);
+
+void register_check(sched_check_t* c);
+
+void unregister_check(sched_check_t* c);
+
+int set_check_interval(sched_check_t* c, unsigned interval);
+
+// Notify a suspicious event, safe to call from any process context.
+void sched_alert(void);
+
+// Module parameter operations to expose the interval of a check (the parameter argument must point to the check).
+// When the permissions allow writing, the interval can be tuned through sysfs as well.
+extern const struct kernel_param_ops sched_interval_ops;
+
+#endif
@@ -0,0 +1,126 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/sched.h>
+#include <asm/io.h>
+
+#include "log.h"
+#include "intent.h"
+#include "scheduler.h"
+
+static gb_intent_page_t* page; // Page shared with the PLC runtime
+static u32 consumed[INTENT_PINS]; // Sequence number of the last accepted (or expired) change of each pin
+static u32 seen[INTENT_PINS]; // Sequence number of each pin as of the last expiry check
+static pid_t owner; // PLC runtime, the only process allowed to use the page
+
+static void expire_check(void);
+
+// Run by the scheduler task, as the I/O monitor loop: consumed[] needs no locks
+static sched_check_t intent_check = {
+	.name = "Intent expiry",
+	.check = expire_check,
+	.interval = INTENT_TIMEOUT
+};
+module_param_cb(intent_timeout, &sched_interval_ops, &intent_check, 0644);
+MODULE_PARM_DESC(intent_timeout, "Time in microseconds after which an unused declaration of the PLC runtime expires (up to twice as much)");
+
+static int intent_open(struct inode* inode, struct file* file) {
+	if (task_tgid_nr(current) != owner) {
+		log_info("Intent channel: access denied to process %d\n", task_tgid_nr(current));
+		return -EPERM;
+	}
+	return 0;
+}
+
+static int intent_mmap(struct file* file, struct vm_area_struct* vma) {
+	if (task_tgid_nr(current) != owner)
+		return -EPERM;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	// The page stays with the owner
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND;
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(page) >> PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot);
+}
+
+static const struct file_operations intent_fops = {
+	.owner = THIS_MODULE, // The module cannot be removed while the page is mapped
+	.open = intent_open,
+	.mmap = intent_mmap
+};
+
+static struct miscdevice intent_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = INTENT_DEVICE,
+	.fops = &intent_fops,
+	.mode = 0600
+};
+
+int start_intent(int pid) {
+	int res;
+
+	BUILD_BUG_ON(sizeof(gb_intent_page_t) > PAGE_SIZE);
+
+	page = (gb_intent_page_t*)get_zeroed_page(GFP_KERNEL);
+	if (!page) {
+		log_err("Unable to allocate kernel space for intent channel\n");
+		return -ENOMEM;
+	}
+	memset(consumed, 0, sizeof(consumed));
+	memset(seen, 0, sizeof(seen));
+	owner = pid;
+
+	if ( (res = misc_register(&intent_dev)) ) {
+		log_err("Unable to register intent channel: %d\n", res);
+		free_page((unsigned long)page);
+		page = NULL;
+		return res;
+	}
+
+	register_check(&intent_check);
+	log_info("Intent channel ready for process %d\n", owner);
+	return 0;
+}
+
+// The scheduler is already stopped
+void stop_intent(void) {
+	if (!page) return;
+	unregister_check(&intent_check);
+	misc_deregister(&intent_dev);
+	free_page((unsigned long)page);
+	page = NULL;
+}
+
+int match_intent(unsigned pin, unsigned mode) {
+	gb_intent_t* e;
+	u32 seq;
+
+	if (!page || pin >= INTENT_PINS) return 0;
+	e = &page->pins[pin];
+
+	seq = READ_ONCE(e->seq);
+	if ((seq & 1) || seq == consumed[pin]) return 0; // Being written, or already accepted
+	smp_rmb();
+	if (READ_ONCE(e->mode) != mode) return 0;
+	smp_rmb();
+	if (READ_ONCE(e->seq) != seq) return 0; // Written again meanwhile
+
+	consumed[pin] = seq;
+	return 1;
+}
+
+// A declaration still there since the previous check has not been used by a change (e.g. the pin was already
+// in that mode, or the runtime did not write the register): it is expired, so that it cannot be used later.
+static void expire_check(void) {
+	unsigned pin;
+	u32 seq;
+
+	for (pin = 0; pin < INTENT_PINS; pin++) {
+		seq = READ_ONCE(page->pins[pin].seq);
+		if (seq == seen[pin] && !(seq & 1)) consumed[pin] = seq;
+		seen[pin] = seq;
+	}
+}
@@ -0,0 +1,66 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/ioport.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+
+#include "log.h"
+#include "io_discovery.h"
+#include "io_dt.h"
+
+unsigned long io_base_offset;
+static resource_size_t node_size = IO_DT_SPAN; // Size of the pin controller node
+
+int discover_io_base(void) {
+	struct device_node* np;
+	struct resource res;
+	int err;
+
+	np = of_find_compatible_node(NULL, NULL, IO_DT_COMPATIBLE);
+	if (!np) {
+		log_info("No %s node in device tree, using static I/O configuration\n", IO_DT_COMPATIBLE);
+		return 0;
+	}
+
+	err = -ENODEV;
+	if (!of_device_is_available(np)) {
+		log_err("Pin controller %s is disabled\n", np->full_name);
+		goto put_node;
+	}
+
+	if ( (err = of_address_to_resource(np, 0, &res)) ) {
+		log_err("Unable to get the address of pin controller %s\n", np->full_name);
+		goto put_node;
+	}
+
+	// Blocks are rebased as a whole, so the page offset must be kept as well
+	if (resource_size(&res) < IO_DT_SPAN || offset_in_page(res.start) != offset_in_page(IO_DT_BASE)) {
+		log_err("Pin controller %s at %pR does not match the static I/O configuration\n", np->full_name, &res);
+		err = -ENODEV;
+		goto put_node;
+	}
+
+	io_base_offset = (unsigned long)res.start - IO_DT_BASE;
+	node_size = resource_size(&res);
+	log_info("Pin controller %s at %pR\n", np->full_name, &res);
+
+put_node:
+	of_node_put(np);
+	return err;
+}
+
+int check_io_base(const void** addrs, const unsigned* sizes, unsigned blocks) {
+	unsigned long start;
+	unsigned b;
+
+	for (b = 0; b < blocks; b++) {
+		start = (unsigned long)addrs[b] - IO_DT_BASE;
+		if (start >= node_size || sizes[b] > node_size - start) {
+			log_err("I/O block %08lx is outside of the pin controller\n", (long)addrs[b]);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
@@ -2,26 +2,103 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/errno.h>
-#include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
 #include <asm/io.h>
 
 #include "io_monitor.h"
 #include "io_conf.h"
 #include "io_debug.h"
+#include "dr_monitor.h" // For watch_dr_slots
+#include "scheduler.h"
+#include "intent.h"
+#include "events.h"
 
 static const io_conf_t* io_conf; // Physical I/O configuration
 static volatile void** addrs; // I/O virtual addresses
-static const void* trusted_state; // Trusted state in I/O memory
-static struct task_struct* task; // I/O monitor main task
+static const void* trusted_state; // Trusted state in I/O memory, as read at startup (see save_trusted_state)
+static io_scan_t* plan; // Scan plan (see io_conf.h), grouped by tier
+static unsigned tier_first[IO_TIERS], tier_count[IO_TIERS]; // Entries of each tier
+static struct workqueue_struct* verify_wq; // Work queue for legitimacy verifications
+static DEFINE_SPINLOCK(commit_lock); // To serialize trusted state updates and restores
 static int runtime_pid;
 static void* runtime_vaddr;
 
-static int monitor_loop(void* data);
+// Context of a batch of detections waiting for their verdict.
+// Detection info is copied, because check_io_state() reuses its own buffers.
+typedef struct {
+	struct work_struct work;
+	struct list_head batches; // Batches not started yet
+	unsigned long key; // Batch key (see io_verify_key)
+	int verdict; // Verdict of an upload batch, until committed
+	io_detect_t info;
+	char target_info[IO_TARGET_INFO_SIZE] __aligned(sizeof(long));
+} io_verify_t;
+
+static LIST_HEAD(queued_list); // Batches waiting for verification, protected by commit_lock
+
+// Learning phase (see io_conf.h): its steps share the verification work queue
+static struct work_struct learn_work[IO_LEARN_STEPS];
+static atomic_t learn_left = ATOMIC_INIT(0); // Steps not completed yet
+static int learn = 1; // Learn at startup
+static int learn_ready; // Set once DRs can be handed out (see start_io_learning)
+
+/*
+ * Logic upload transaction.
+ * Uploading a new PLC logic reconfigures many pins at once: instead of verifying each change
+ * while the upload is still in progress, the changes are recorded while the transaction is open
+ * (kept pending, so they are not detected again). When it is closed (or after 'upload_timeout' milliseconds),
+ * a learning phase profiles the new logic (once any phase in progress is over), then all the recorded changes
+ * are verified concurrently, and the new trusted state is committed at once. Pin multiplexing changes are still
+ * restored immediately.
+ */
+#define UPLOAD_IDLE     	0
+#define UPLOAD_OPEN     	1
+#define UPLOAD_VERIFYING	2
+static int upload = UPLOAD_IDLE; // Transaction state, protected by commit_lock
+static int upload_relearn; // Closed, but no learning phase started since, protected by commit_lock
+static unsigned upload_timeout = 30000; // Maximum upload time in milliseconds
+static LIST_HEAD(upload_list); // Batches recorded by the transaction, protected by commit_lock
+static atomic_t upload_left = ATOMIC_INIT(0); // Batches not verified yet (see verify_upload)
+static struct work_struct upload_work;
+static struct delayed_work upload_expire;
+
+static void monitor_check(void);
+static void secondary_check(void);
+static void verify_io_change(struct work_struct* work);
+static void learn_io(struct work_struct* work);
+static int start_learning(void);
+static void verify_upload(struct work_struct* work);
+static void expire_upload(struct work_struct* work);
+static int compile_plan(void);
+static void save_trusted_state(void);
 static int map_addrs(void);
 static void unmap_addrs(int mapped);
 
+static sched_check_t io_check = {
+	.name = "I/O monitor",
+	.check = monitor_check,
+	.interval = IO_MONITOR_INTERVAL,
+	.adaptive = 1
+};
+module_param_cb(io_interval, &sched_interval_ops, &io_check, 0644);
+MODULE_PARM_DESC(io_interval, "I/O monitor interval in microseconds");
+
+// Secondary tier (see io_conf.h), registered only if some block belongs to it
+static sched_check_t io_secondary_check = {
+	.name = "I/O monitor (secondary)",
+	.check = secondary_check,
+	.interval = IO_SECONDARY_INTERVAL,
+	.adaptive = 1
+};
+static int has_secondary;
+module_param_cb(io_secondary_interval, &sched_interval_ops, &io_secondary_check, 0644);
+MODULE_PARM_DESC(io_secondary_interval, "I/O monitor interval of secondary control registers in microseconds");
+
 int start_io_monitor(int pid, void* vaddr) {
+	unsigned i;
 	int res;
 
 	// Store PLC runtime info
@@ -30,6 +107,8 @@ int start_io_monitor(int pid, void* vaddr) {
 
 	// Get model-specific physical I/O configuration
 	io_conf = PHYS_IO_CONF;
+	if ( (res = check_io_base(io_conf->addrs, io_conf->sizes, io_conf->blocks)) )
+		goto map_failed;
 
 	// Map I/O physical address to kernel virtual addresses
 	res = map_addrs();
@@ -45,19 +124,45 @@ int start_io_monitor(int pid, void* vaddr) {
 
 	// Read trusted state from I/O memory
 	get_io_state(addrs, (void*)trusted_state);
+
+	if ( (res = compile_plan()) )
+		goto plan_failed;
+
+	// Verifications run concurrently, up to the number of available watchpoints:
+	// the others wait in the work queue. Its CPUs can be set through sysfs (e.g. apart from the PLC runtime).
+	verify_wq = alloc_workqueue("io_verify", WQ_UNBOUND | WQ_SYSFS, max(watch_dr_slots(), 1u));
+	if (!verify_wq) {
+		log_err("Unable to create work queue for I/O monitor\n");
+		res = -ENOMEM;
+		goto wq_failed;
+	}
 	
-	// Start monitor task
-	task = kthread_run(&monitor_loop, NULL, "io_monitor");
-	if (IS_ERR((void*)task)) {
-		log_err("Unable to create thread: %ld\n", PTR_ERR((void*)task));
-		res = PTR_ERR((void*)task);
-		goto task_failed;
+	dump_io_state();
+
+	// Let the PLC runtime declare its changes
+	if ( (res = start_intent(pid)) )
+		goto intent_failed;
+
+	for (i = 0; i < IO_LEARN_STEPS; i++) {
+		INIT_WORK(&learn_work[i], learn_io);
 	}
+	INIT_WORK(&upload_work, verify_upload);
+	INIT_DELAYED_WORK(&upload_expire, expire_upload);
+
+	// Register monitor checks, one for each tier in use
+	register_check(&io_check);
+	has_secondary = tier_count[IO_TIER_SECONDARY] != 0;
+	if (has_secondary) register_check(&io_secondary_check);
 
 	log_info("I/O monitor started\n");
 	return 0;
 
-task_failed:
+intent_failed:
+	destroy_workqueue(verify_wq);
+	verify_wq = NULL;
+wq_failed:
+	kfree(plan);
+plan_failed:
 	kfree(trusted_state);
 trusted_failed:
 	unmap_addrs(io_conf->blocks);
@@ -65,45 +170,326 @@ map_failed:
 	return res;
 }
 
-static int monitor_loop(void* data) {
-	unsigned b, offset;
+// Registers are grouped by tier, and each tier is in block order
+static int compile_plan(void) {
+	const io_reg_t* reg;
+	io_scan_t* e;
+	unsigned t, b, r, offset, count = 0;
 
-	dump_io_state();
+	for (b = 0; b < io_conf->blocks; b++) {
+		for (r = 0; r < io_conf->reg_counts[b]; r++) {
+			reg = &io_conf->regs[b][r];
+			if (reg->mask && reg->policy != IO_IGNORED) count++;
+		}
+	}
+
+	plan = kcalloc(count, sizeof(io_scan_t), GFP_KERNEL);
+	if (!plan) {
+		log_err("Unable to allocate kernel space for I/O scan plan\n");
+		return -ENOMEM;
+	}
 
-	while (1) {
-		// Check I/O blocks
+	for (t = 0, e = plan; t < IO_TIERS; t++) {
+		tier_first[t] = e - plan;
 		for (b = 0, offset = 0; b < io_conf->blocks; offset += io_conf->sizes[b++]) { // For each block
-			// Read from I/O memory in an architecture-independent manner.
-			check_io_state(addrs[b], trusted_state + offset, b);
+			if (io_conf->tiers[b] != t) continue;
+			for (r = 0; r < io_conf->reg_counts[b]; r++) { // For each register
+				reg = &io_conf->regs[b][r];
+				if (!reg->mask || reg->policy == IO_IGNORED) continue;
+				e->addr = (volatile char*)addrs[b] + reg->offset;
+				e->offset = offset + reg->offset;
+				e->trusted = reg->width == sizeof(u16) ? *(u16*)(trusted_state + e->offset) : *(u32*)(trusted_state + e->offset);
+				e->mask = reg->mask;
+				e->policy = reg->policy;
+				e->block = b;
+				e->width = reg->width;
+				e++;
+			}
 		}
+		tier_count[t] = e - plan - tier_first[t];
+	}
+
+	log_info("I/O scan plan: %u registers, %u critical\n", count, tier_count[IO_TIER_CRITICAL]);
+	return 0;
+}
 
-		usleep_range(IO_MIN_RANGE(IO_MONITOR_INTERVAL), IO_MAX_RANGE(IO_MONITOR_INTERVAL));
-		if (kthread_should_stop()) return 0;
+// Trusted values are updated into the scan plan: copy them back into the trusted state,
+// for the interfaces which need the whole state. Commit lock held by the caller (if running).
+static void save_trusted_state(void) {
+	io_scan_t* e;
+
+	for (e = plan; e < plan + tier_first[IO_TIERS - 1] + tier_count[IO_TIERS - 1]; e++) {
+		if (e->width == sizeof(u16)) *(u16*)(trusted_state + e->offset) = e->trusted;
+		else *(u32*)(trusted_state + e->offset) = e->trusted;
+	}
+}
+
+static void monitor_check(void) {
+	check_io_state(plan + tier_first[IO_TIER_CRITICAL], tier_count[IO_TIER_CRITICAL]);
+}
+
+static void secondary_check(void) {
+	check_io_state(plan + tier_first[IO_TIER_SECONDARY], tier_count[IO_TIER_SECONDARY]);
+}
+
+#define record_io_event(info, verdict)	\
+	record_event(GB_EVENT_IO, verdict, raw_smp_processor_id(), (unsigned long)(info)->target,	\
+	             (unsigned long)(info)->old_val, (unsigned long)(info)->new_val, 0)
+
+// Commit lock already held by the caller.
+// A partial verdict updates the legitimate changes and restores the others.
+static void commit_io_verdict(io_detect_t* info, int verdict) {
+	record_io_event(info, verdict == LEGITIMATE ? GB_VERDICT_LEGITIMATE : GB_VERDICT_ILLEGAL);
+	if (verdict != NOT_LEGITIMATE) {
+		update_io_state(info);
+		log_event("Legitimate change, configuration updated!\n");
+	}
+	if (verdict != LEGITIMATE) {
+		log_event("Illegal change: Pin Control Attack!\n");
+		restore_io_state(info);
 	}
 }
 
 void handle_io_detection(io_detect_t* info) {
-	log_info("I/O change detected: 0x%08lx [old value = 0x%08lx, new value = 0x%08lx]\n",
-	         (long)info->target, info->old_val, info->new_val);
+	io_verify_t* ctx;
+	struct list_head* list;
+	unsigned long key;
+	unsigned pin, mode;
+	int verdict, queued;
+
+	log_event("I/O change detected: 0x%08lx [old value = 0x%08lx, new value = 0x%08lx]\n",
+	          (long)info->target, info->old_val, info->new_val);
+	sched_alert();
 
 	dump_io_state();
 
-	if (is_legitimate(info, runtime_pid, runtime_vaddr)) {
-		update_io_state(info);
-		log_info("Legitimate change, configuration updated!\n");
+	// Changes declared by the PLC runtime are accepted right away
+	if (io_change_intent(info, &pin, &mode) && match_intent(pin, mode)) {
+		accept_io_change(info);
+		verdict = LEGITIMATE;
+		log_event("Change declared by the PLC runtime\n");
 	} else {
-		log_info("Illegal change: Pin Control Attack!\n");
-		restore_io_state(info);
+		verdict = classify_io_change(info);
+	}
+	if (verdict != UNDECIDED) {
+		spin_lock(&commit_lock);
+		commit_io_verdict(info, verdict);
+		spin_unlock(&commit_lock);
+		return;
+	}
+
+	// The verdict requires observing the PLC logic: defer it to the work queue,
+	// so that the monitor loop keeps scanning every register meanwhile.
+	// Join a batch waiting for the same verification (or recorded by an upload), if any.
+	key = io_verify_key(info);
+	spin_lock(&commit_lock);
+	list = upload == UPLOAD_OPEN ? &upload_list : &queued_list;
+	list_for_each_entry(ctx, list, batches) {
+		if (ctx->key == key) {
+			merge_io_change(&ctx->info, info);
+			mark_io_pending(&ctx->info);
+			spin_unlock(&commit_lock);
+			record_io_event(info, GB_VERDICT_PENDING);
+			log_event("Verification pending (batched)\n");
+			return;
+		}
+	}
+	spin_unlock(&commit_lock);
+
+	// Only the monitor loop adds batches, so no batch with this key can be added meanwhile
+	ctx = kmalloc(sizeof(io_verify_t), GFP_KERNEL);
+	if (!ctx) {
+		log_err("Unable to allocate kernel space for I/O verification\n");
+		spin_lock(&commit_lock);
+		commit_io_verdict(info, NOT_LEGITIMATE);
+		spin_unlock(&commit_lock);
+		return;
+	}
+	memcpy(ctx->target_info, info->target_info, IO_TARGET_INFO_SIZE);
+	ctx->info = *info;
+	ctx->info.target_info = (void*)ctx->target_info;
+	ctx->key = key;
+	INIT_WORK(&ctx->work, verify_io_change);
+
+	spin_lock(&commit_lock);
+	queued = upload != UPLOAD_OPEN;
+	list_add_tail(&ctx->batches, queued ? &queued_list : &upload_list);
+	mark_io_pending(&ctx->info);
+	spin_unlock(&commit_lock);
+
+	record_io_event(info, GB_VERDICT_PENDING);
+	if (queued) {
+		queue_work(verify_wq, &ctx->work);
+		log_event("Verification pending\n");
+	} else {
+		log_event("Verification pending (upload)\n");
+	}
+}
+
+static void verify_io_change(struct work_struct* work) {
+	io_verify_t* ctx = container_of(work, io_verify_t, work);
+	int verdict;
+
+	// The batch is closed from now on
+	spin_lock(&commit_lock);
+	list_del(&ctx->batches);
+	spin_unlock(&commit_lock);
+
+	verdict = is_legitimate(&ctx->info, runtime_pid, runtime_vaddr);
+
+	// Speculative change is committed (or reverted) only now
+	spin_lock(&commit_lock);
+	commit_io_verdict(&ctx->info, verdict);
+	clear_io_pending(&ctx->info);
+	spin_unlock(&commit_lock);
+
+	kfree(ctx);
+}
+
+// A phase started before the upload was closed profiled the previous logic (at least in part):
+// the transaction is committed only at the end of a phase started afterwards.
+static void learn_io(struct work_struct* work) {
+	int relearn;
+
+	learn_io_step(work - learn_work, runtime_pid, runtime_vaddr);
+	if (!atomic_dec_and_test(&learn_left)) return;
+
+	spin_lock(&commit_lock);
+	save_trusted_state();
+	end_io_learning(trusted_state);
+	relearn = upload == UPLOAD_VERIFYING && upload_relearn;
+	if (upload == UPLOAD_VERIFYING && !relearn) queue_work(verify_wq, &upload_work);
+	spin_unlock(&commit_lock);
+	log_event("I/O learning completed\n");
+
+	if (relearn) start_learning();
+}
+
+static int start_learning(void) {
+	unsigned i;
+
+	if (!IO_LEARN_STEPS) return -EOPNOTSUPP;
+	if (atomic_cmpxchg(&learn_left, 0, IO_LEARN_STEPS))
+		return -EBUSY; // Already learning
+
+	spin_lock(&commit_lock);
+	begin_io_learning();
+	upload_relearn = 0;
+	spin_unlock(&commit_lock);
+
+	for (i = 0; i < IO_LEARN_STEPS; i++) {
+		queue_work(verify_wq, &learn_work[i]);
+	}
+	log_event("I/O learning started\n");
+	return 0;
+}
+
+static int open_upload(void) {
+	spin_lock(&commit_lock);
+	if (upload != UPLOAD_IDLE) {
+		spin_unlock(&commit_lock);
+		return -EBUSY;
+	}
+	upload = UPLOAD_OPEN;
+	spin_unlock(&commit_lock);
+
+	queue_delayed_work(verify_wq, &upload_expire, msecs_to_jiffies(READ_ONCE(upload_timeout)));
+	log_event("Logic upload started by process %d\n", task_tgid_nr(current));
+	return 0;
+}
+
+static int close_upload(void) {
+	spin_lock(&commit_lock);
+	if (upload != UPLOAD_OPEN) {
+		spin_unlock(&commit_lock);
+		return -EINVAL;
 	}
+	upload = UPLOAD_VERIFYING;
+	upload_relearn = 1;
+	spin_unlock(&commit_lock);
+
+	log_event("Logic upload completed, verifying changes\n");
+	// The transaction is committed at the end of learning: if a phase is in progress, a new one follows it
+	if (start_learning() == -EOPNOTSUPP) queue_work(verify_wq, &upload_work);
+	return 0;
+}
+
+static void expire_upload(struct work_struct* work) {
+	if (!close_upload()) log_event("Logic upload timed out\n");
+}
+
+// Verdicts are collected first, then the whole transaction is committed at once, by the last verification.
+static void commit_upload(void) {
+	io_verify_t *ctx, *tmp;
+	unsigned changes = 0;
+
+	spin_lock(&commit_lock);
+	list_for_each_entry_safe(ctx, tmp, &upload_list, batches) {
+		commit_io_verdict(&ctx->info, ctx->verdict);
+		clear_io_pending(&ctx->info);
+		kfree(ctx);
+		changes++;
+	}
+	INIT_LIST_HEAD(&upload_list);
+	upload = UPLOAD_IDLE;
+	spin_unlock(&commit_lock);
+
+	log_event("Logic upload committed (%u batches)\n", changes);
+}
+
+static void verify_upload_change(struct work_struct* work) {
+	io_verify_t* ctx = container_of(work, io_verify_t, work);
+
+	ctx->verdict = is_legitimate(&ctx->info, runtime_pid, runtime_vaddr);
+	if (atomic_dec_and_test(&upload_left)) commit_upload();
+}
+
+// The batches of the transaction are verified concurrently in the work queue, as the other verifications.
+// No batch can be added meanwhile, since the transaction is closed. The extra count keeps the last
+// verification from committing (and freeing the batches) while they are still being queued.
+static void verify_upload(struct work_struct* work) {
+	io_verify_t* ctx;
+
+	cancel_delayed_work(&upload_expire);
+
+	atomic_set(&upload_left, 1);
+	list_for_each_entry(ctx, &upload_list, batches) {
+		atomic_inc(&upload_left);
+		INIT_WORK(&ctx->work, verify_upload_change);
+		queue_work(verify_wq, &ctx->work);
+	}
+	if (atomic_dec_and_test(&upload_left)) commit_upload();
 }
 
 int map_overlaps_io(unsigned long start, unsigned long end) {
 	__map_overlaps_io(start, end);
 }
 
+// Profile the PLC logic meanwhile: changes are verified by observing it until done.
+// Learning steps claim DRs, so this is called once the DR monitor has set up its pool.
+void start_io_learning(void) {
+	WRITE_ONCE(learn_ready, 1);
+	if (learn) start_learning();
+}
+
 void stop_io_monitor(void) {
-	kthread_stop(task);
+	io_verify_t *ctx, *tmp;
+
+	WRITE_ONCE(learn_ready, 0);
+	unregister_check(&io_check);
+	if (has_secondary) unregister_check(&io_secondary_check);
+	cancel_delayed_work_sync(&upload_expire);
+	destroy_workqueue(verify_wq); // Wait for pending verifications and learning
+	verify_wq = NULL;
+	list_for_each_entry_safe(ctx, tmp, &upload_list, batches) { // Upload still open
+		kfree(ctx);
+	}
+	INIT_LIST_HEAD(&upload_list);
+	upload = UPLOAD_IDLE;
+	upload_relearn = 0;
+	stop_intent();
 	unmap_addrs(io_conf->blocks);
+	kfree(plan);
 	kfree(trusted_state);
 	log_info("I/O monitor stopped\n");
 }
@@ -119,9 +505,9 @@ static int map_addrs() {
 	}
 
 	for (i = 0; i < io_conf->blocks; i++) {
-		addrs[i] = ioremap((phys_addr_t)io_conf->addrs[i], io_conf->sizes[i]);
+		addrs[i] = ioremap((phys_addr_t)IO_BLOCK_PHYS(io_conf, i), io_conf->sizes[i]);
 		if (IS_ERR((void*)addrs[i])) {
-			log_err("Unable to map I/O address %08lx\n", (long)io_conf->addrs[i]);
+			log_err("Unable to map I/O address %08lx\n", IO_BLOCK_PHYS(io_conf, i));
 			res = PTR_ERR((void*)addrs[i]);
 			goto iomap_failed;
 		}
@@ -143,3 +529,49 @@ static void unmap_addrs(int mapped) {
 
 	kfree(addrs);
 }
+
+/*
+ * Learning mode: 1 to learn at startup (default), 0 to always verify by observing the PLC logic.
+ * While the monitor is running, writing 1 starts a new learning phase, e.g. after a PLC logic upload.
+ */
+static int set_learn_param(const char* val, const struct kernel_param* kp) {
+	int res;
+
+	if ( (res = param_set_int(val, kp)) )
+		return res;
+	if (learn && READ_ONCE(learn_ready))
+		return start_learning();
+	return 0;
+}
+
+static const struct kernel_param_ops learn_ops = {
+	.set = set_learn_param,
+	.get = param_get_int
+};
+
+module_param_cb(io_learn, &learn_ops, &learn, 0644);
+MODULE_PARM_DESC(io_learn, "Learn the I/O usage of the PLC logic at startup, write 1 to learn again (e.g. after a logic upload)");
+
+/*
+ * Logic upload transaction: write 1 when the upload starts, and 0 when it is completed.
+ * Reading gives the transaction state (0 idle, 1 open, 2 verifying).
+ */
+static int set_upload_param(const char* val, const struct kernel_param* kp) {
+	int open, res;
+
+	if ( (res = kstrtoint(val, 0, &open)) )
+		return res;
+	if (!verify_wq)
+		return -ENODEV;
+	return open ? open_upload() : close_upload();
+}
+
+static const struct kernel_param_ops upload_ops = {
+	.set = set_upload_param,
+	.get = param_get_int
+};
+
+module_param_cb(io_upload, &upload_ops, &upload, 0644);
+MODULE_PARM_DESC(io_upload, "Logic upload transaction: 1 to open, 0 to commit (reads 0 idle, 1 open, 2 verifying)");
+module_param(upload_timeout, uint, 0644);
+MODULE_PARM_DESC(upload_timeout, "Time in milliseconds after which an open logic upload is committed anyway");
@@ -5,6 +5,9 @@
 #include "io_monitor.h"
 #include "dr_monitor.h"
 #include "map_monitor.h"
+#include "scheduler.h"
+#include "patch.h"
+#include "events.h"
 
 static int p_pid;
 static char* vaddr_base;
@@ -30,30 +33,68 @@ int __init init_module(void) {
 		return -EINVAL;
 	}
 
+	// Find the I/O blocks of the running board first (see io_discovery.h)
+	if ( (res = discover_io_base()) )
+		return res;
+
+	// Detections are recorded from the start
+	if ( (res = start_events()) )
+		return res;
+
 	if ( (res = start_io_monitor(p_pid, (void*)l)) )
 		goto io_failed;
 
+	// Kernel patches of all the monitors are applied together, stopping the machine once
+	begin_patches();
+
 	if ( (res = start_dr_monitor()) )
 		goto dr_failed;
 
 	if ( (res = start_map_monitor()) )
 		goto map_failed;
 
+	// Nothing is patched if any write fails
+	if ( (res = end_patches()) )
+		goto patches_failed;
+
+	// Learning needs the DR pool
+	start_io_learning();
+
+	// Run the checks registered by the monitors
+	if ( (res = start_scheduler(p_pid)) )
+		goto scheduler_failed;
+
 	log_info("Ghostbuster started\n");
 	return 0;
 
+scheduler_failed:
+patches_failed:
+	stop_io_monitor(); // Pending verifications use DRs, as in cleanup_module()
+	begin_patches();
+	stop_map_monitor();
+	stop_dr_monitor();
+	end_patches();
+	stop_events();
+	return res;
+
 map_failed:
 	stop_dr_monitor();
 dr_failed:
-	stop_io_monitor();
+	end_patches();
+	stop_io_monitor(); // No verification nor learning started yet
 io_failed:
+	stop_events();
 	return res;
 }
 
 void __exit cleanup_module() {
+	stop_scheduler();
+	stop_io_monitor(); // Pending verifications use DRs
+	begin_patches();
 	stop_map_monitor();
 	stop_dr_monitor();
-	stop_io_monitor();
+	end_patches();
+	stop_events();
 	log_info("Ghostbuster stopped\n");
 }
 
@@ -10,6 +10,8 @@
 #include "map_conf.h"
 #include "map_monitor.h"
 #include "map_debug.h"
+#include "scheduler.h" // For sched_alert
+#include "events.h"
 
 // Syscall hooks
 static asmlinkage long my_mmap2(unsigned long addr, unsigned long len,
@@ -39,8 +41,14 @@ static void* original[HOOKS_COUNT];
 #define remap_file_pages_real	((remap_file_pages_t)original[REMAP_FILE_PAGES_INDEX])
 #define munmap_real          	((munmap_t)original[MUNMAP_INDEX])
 
+#define record_map_event(verdict, paddr, vaddr, len, pid)	\
+	record_event(GB_EVENT_MAP, verdict, raw_smp_processor_id(), paddr, vaddr, len, pid)
+
 int start_map_monitor(void) {
-	hook_map_syscalls(hooks, original, free_maps);
+	int res;
+
+	if ( (res = hook_map_syscalls(hooks, original, free_maps)) )
+		return res;
 
 	log_info("MAP monitor started\n");
 	return 0;
@@ -65,8 +73,10 @@ static asmlinkage long my_mmap2(unsigned long addr, unsigned long len,
 		start = pgoff << PAGE_SHIFT;
 		end = start + len; // end is also pagealigned
 		if (map_overlaps_io(start, end)) {
-			log_info("mmap2 request: phys[0x%08lx - 0x%08lx] from %s (%d)", start, end, comm, pid);
+			log_event("mmap2 request: phys[0x%08lx - 0x%08lx] from %s (%d)", start, end, comm, pid);
+			sched_alert();
 			handle_mmap(vaddr, mmap2_real, addr, len, prot, flags, fd, pgoff);
+			record_map_event(GB_VERDICT_ILLEGAL, start, vaddr, len, pid);
 		} else {
 			vaddr = mmap2_real(addr, len, prot, flags, fd, pgoff);
 		}
@@ -101,9 +111,11 @@ static asmlinkage long my_mremap(unsigned long addr,
 	if (new_len > old_len) { // Growing is dangerous
 		end = paddr + new_len;
 		if (map_overlaps_io(paddr, end)) {
-			log_info("mremap request: virt[0x%08lx - 0x%08lx] to virt[0x%08lx - 0x%08lx] from %s (%d)",
-			         addr, addr + old_len, n_addr, n_addr + new_len, comm, pid);
+			log_event("mremap request: virt[0x%08lx - 0x%08lx] to virt[0x%08lx - 0x%08lx] from %s (%d)",
+			          addr, addr + old_len, n_addr, n_addr + new_len, comm, pid);
+			sched_alert();
 			handle_mremap(vaddr, mremap_real, addr, old_len, new_len, flags, new_addr);
+			record_map_event(GB_VERDICT_ILLEGAL, paddr, vaddr, new_len, pid);
 			goto mapping_update;
 		}
 	}
@@ -137,15 +149,21 @@ static asmlinkage long my_remap_file_pages(unsigned long addr, unsigned long len
 	start = pgoff << PAGE_SHIFT;
 	end = start + len;
 	if (map_overlaps_io(start, end)) {
-		log_info("remap_file_pages request: phys[0x%08lx - 0x%08lx] to phys[0x%08lx - 0x%08lx] from %s (%d)",
-		         paddr, paddr + len, start, end, comm, pid);
+		log_event("remap_file_pages request: phys[0x%08lx - 0x%08lx] to phys[0x%08lx - 0x%08lx] from %s (%d)",
+		          paddr, paddr + len, start, end, comm, pid);
 		handle_remap_fp(res, remap_file_pages_real, addr, len, prot, pgoff, flags);
+		record_map_event(GB_VERDICT_ILLEGAL, start, addr, len, pid);
 		goto mapping_alter;
 	}
 
 	res = remap_file_pages_real(addr, len, prot, pgoff, flags);
 mapping_alter:
-	if (!res) alter_mapping(addr, start, len, pid);
+	if (!res) {
+		if (alter_mapping(addr, start, len, pid)) {
+			log_err("Unable to allocate kernel space for page mappings\n");
+			stop_map_monitor();
+		}
+	}
 	return res;
 
 original_remap_file_pages:
@@ -153,16 +171,21 @@ original_remap_file_pages:
 }
 
 static asmlinkage long my_munmap(unsigned long addr, size_t len) {
+	unsigned long paddr;
 	pid_t pid = current->pid;
 	char* comm = current->comm;
 
 	if (addr & ~PAGE_MASK) goto original_munmap;
 	len = PAGE_ALIGN(len);
 
-	if (!get_mapped_phys(addr, pid)) goto original_munmap; // Not referred to physical memory
-	log_info("munmap request: virt[0x%08lx - 0x%08lx] from %s (%d)\n", addr, addr + len, comm, pid);
+	if (!(paddr = get_mapped_phys(addr, pid))) goto original_munmap; // Not referred to physical memory
+	record_map_event(GB_VERDICT_LEGITIMATE, paddr, addr, len, pid);
+	log_event("munmap request: virt[0x%08lx - 0x%08lx] from %s (%d)\n", addr, addr + len, comm, pid);
 
-	delete_mapping(addr, len, pid);
+	if (delete_mapping(addr, len, pid)) {
+		log_err("Unable to allocate kernel space for page mappings\n");
+		stop_map_monitor();
+	}
 
 original_munmap:
 	return munmap_real(addr, len);
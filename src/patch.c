@@ -0,0 +1,120 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/stop_machine.h>
+#include <linux/ktime.h>
+
+#include "log.h"
+#include "patch.h"
+#include "patch_conf.h"
+
+typedef struct {
+	u32* addr;          	// Address to patch
+	const u32* new_text;	// Words to write
+	u32* old_text;      	// Buffer to save previous words into, if any
+	unsigned words;     	// Number of words
+	int data;           	// Data words, not kernel text
+} patch_t;
+
+static patch_t patches[PATCH_MAX_ENTRIES]; // Queued writes
+static unsigned patch_count;
+static int patch_error; // First error of the open transaction
+static struct task_struct* owner; // Task with an open transaction
+static DEFINE_MUTEX(patch_lock); // To serialize transactions
+static u64 write_time; // Time spent writing, in nanoseconds
+
+static int __apply_patches(void* data) {
+	u64 start = local_clock();
+	patch_t* p;
+	unsigned i;
+
+	for (p = patches; p < patches + patch_count; p++) {
+		if (p->old_text) {
+			for (i = 0; i < p->words; i++)
+				p->old_text[i] = p->addr[i];
+		}
+		if (p->data) __patch_data(p->addr, p->new_text, p->words);
+		else __patch_words(p->addr, p->new_text, p->words);
+	}
+	write_time = local_clock() - start;
+	return 0;
+}
+
+// Mutex already held by the caller
+static int commit_patches(void) {
+	ktime_t start;
+	s64 stall;
+	int res = patch_error;
+
+	if (!res && patch_count) res = init_patch();
+	if (res) {
+		log_err("Kernel patches not applied: %d\n", res);
+		goto discard;
+	}
+	if (!patch_count) return 0;
+
+	start = ktime_get();
+	res = stop_machine(__apply_patches, NULL, NULL);
+	stall = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (res) {
+		log_err("Unable to apply %u kernel patches: %d\n", patch_count, res);
+	} else {
+		log_info("Patch: %u writes applied, machine stopped for %lld us (%llu ns writing)\n",
+		         patch_count, div_s64(stall, NSEC_PER_USEC), write_time);
+	}
+discard:
+	patch_count = 0;
+	patch_error = 0;
+	return res;
+}
+
+void begin_patches(void) {
+	mutex_lock(&patch_lock);
+	owner = current;
+}
+
+int end_patches(void) {
+	int res = commit_patches();
+
+	owner = NULL;
+	mutex_unlock(&patch_lock);
+	return res;
+}
+
+static int __queue_patch(void* addr, const void* new_text, void* old_text, unsigned size, int data) {
+	int own = (READ_ONCE(owner) == current); // Only the owner can see itself here
+	int res = 0;
+	patch_t* p;
+
+	if (!own) begin_patches();
+
+	if (patch_count == PATCH_MAX_ENTRIES) {
+		log_err("Too many kernel patches in a transaction\n");
+		res = -ENOSPC;
+	} else if (!addr) {
+		log_err("Kernel patch on a missing symbol\n");
+		res = -ENOENT;
+	} else {
+		p = &patches[patch_count++];
+		p->addr = addr;
+		p->new_text = new_text;
+		p->old_text = old_text;
+		p->words = size / sizeof(u32);
+		p->data = data;
+	}
+	if (res && !patch_error) patch_error = res; // The whole transaction is discarded
+
+	if (!own) res = end_patches();
+	return res;
+}
+
+int queue_patch(void* addr, const void* new_text, void* old_text, unsigned size) {
+	return __queue_patch(addr, new_text, old_text, size, 0);
+}
+
+int queue_data_patch(void* addr, const void* new_data, void* old_data, unsigned size) {
+	return __queue_patch(addr, new_data, old_data, size, 1);
+}
@@ -0,0 +1,399 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/gcd.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/cpumask.h>
+#include <linux/pid.h>
+#include <linux/rcupdate.h>
+#include <uapi/linux/sched/types.h>
+
+#include "log.h"
+#include "scheduler.h"
+#include "scan_timer.h"
+
+static LIST_HEAD(check_list); // Registered checks
+static struct task_struct* task; // Scheduler main task
+static scan_timer_t timer; // Scheduler wake-up timer
+static unsigned base_interval; // Base period in microseconds
+static u64 check_time; // Time spent in all the checks in nanoseconds
+static u64 exec_start; // Scheduler CPU time when started
+static atomic_t replan = ATOMIC_INIT(0); // Set when some interval has been changed
+static unsigned long overruns; // Wake-ups whose checks took longer than the base period
+
+// Scheduling of the task (see scheduler.h)
+static int sched_policy = SCHED_NORMAL; // SCHED_NORMAL, SCHED_FIFO or SCHED_DEADLINE
+static unsigned sched_priority = SCHED_DEFAULT_PRIORITY; // SCHED_FIFO priority
+static unsigned sched_runtime = SCHED_DEFAULT_RUNTIME; // SCHED_DEADLINE budget per base period in microseconds
+static int sched_cpu = -1; // CPU the task is bound to (-1 for any)
+static bool housekeeping; // Keep the task off the CPU of the PLC runtime
+static struct cpumask sched_cpus; // CPUs allowed to the task
+
+// Adaptive policy
+static unsigned quiet_slowdown = 1; // Interval multiplier of adaptive checks while quiet
+static unsigned alert_hold = 1000; // Alert duration in milliseconds
+static unsigned long alert_until; // End of the current alert (jiffies)
+static atomic_t alert_count = ATOMIC_INIT(0); // Number of alerts raised
+static int quiet = 1; // Current policy state, owned by the scheduler task
+static DEFINE_SPINLOCK(task_lock); // To wake up the task safely from any context
+
+static int scheduler_loop(void* data);
+static int set_task_policy(struct task_struct* t);
+
+// Effective interval of a check, according to the policy state
+#define check_interval(c, q)	(READ_ONCE((c)->interval) * ((q) && (c)->adaptive ? READ_ONCE(quiet_slowdown) : 1))
+
+static void plan_checks(int q) {
+	sched_check_t* c;
+	unsigned interval, min_interval = UINT_MAX;
+
+	base_interval = 0;
+	list_for_each_entry(c, &check_list, checks) {
+		interval = check_interval(c, q);
+		base_interval = base_interval ? gcd(base_interval, interval) : interval;
+		min_interval = min(min_interval, interval);
+	}
+	// Intervals with a tiny common divisor would wake the task too often:
+	// use the shortest interval, and round the multipliers of the others.
+	if (base_interval < SCHED_MIN_INTERVAL) {
+		log_info("Scheduler: intervals not multiple of %u us, periods are rounded\n", min_interval);
+		base_interval = min_interval;
+	}
+	list_for_each_entry(c, &check_list, checks) {
+		c->mult = DIV_ROUND_CLOSEST(check_interval(c, q), base_interval);
+		c->countdown = 0; // Run each check in the first wake-up
+	}
+}
+
+// CPUs allowed to the task, according to the affinity parameters
+static int plan_affinity(int runtime_pid) {
+	struct task_struct* runtime;
+	int cpu = -1;
+
+	if (sched_cpu >= 0) {
+		if (sched_cpu >= nr_cpu_ids || !cpu_online(sched_cpu)) {
+			log_err("Scheduler: CPU %d is not online\n", sched_cpu);
+			return -EINVAL;
+		}
+		cpumask_clear(&sched_cpus);
+		cpumask_set_cpu(sched_cpu, &sched_cpus);
+	} else {
+		cpumask_copy(&sched_cpus, cpu_online_mask);
+	}
+
+	// The PLC runtime is supposed to be bound to its own core, so the CPU it runs on now is the one to avoid
+	if (housekeeping) {
+		rcu_read_lock();
+		runtime = pid_task(find_vpid(runtime_pid), PIDTYPE_PID);
+		if (runtime) cpu = task_cpu(runtime);
+		rcu_read_unlock();
+		if (cpu < 0) {
+			log_err("Scheduler: PLC runtime not found, housekeeping CPU not set\n");
+			return -ESRCH;
+		}
+		cpumask_clear_cpu(cpu, &sched_cpus);
+		if (cpumask_empty(&sched_cpus)) {
+			log_err("Scheduler: no housekeeping CPU apart from the PLC runtime CPU %d\n", cpu);
+			return -EINVAL;
+		}
+	}
+
+	// Deadline tasks cannot have a restricted affinity (admission control is per root domain)
+	if (sched_policy == SCHED_DEADLINE && !cpumask_equal(&sched_cpus, cpu_online_mask)) {
+		log_err("Scheduler: SCHED_DEADLINE cannot be combined with CPU affinity\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int start_scheduler(int runtime_pid) {
+	struct task_struct* t;
+	int res;
+
+	if (list_empty(&check_list)) {
+		log_info("Scheduler not needed\n");
+		return 0;
+	}
+
+	if ( (res = plan_affinity(runtime_pid)) )
+		return res;
+
+	atomic_set(&replan, 0);
+	quiet = 1;
+	alert_until = jiffies;
+	plan_checks(quiet);
+	check_time = 0;
+	overruns = 0;
+
+	// Create scheduler task, and set its scheduling before it runs
+	t = kthread_create(&scheduler_loop, NULL, "gb_scheduler");
+	if (IS_ERR((void*)t)) {
+		log_err("Unable to create thread: %ld\n", PTR_ERR((void*)t));
+		return PTR_ERR((void*)t);
+	}
+	if (sched_cpu >= 0)
+		kthread_bind(t, sched_cpu);
+	else if ( (res = set_cpus_allowed_ptr(t, &sched_cpus)) )
+		goto sched_failed;
+	if ( (res = set_task_policy(t)) )
+		goto sched_failed;
+	wake_up_process(t);
+	spin_lock(&task_lock);
+	task = t;
+	spin_unlock(&task_lock);
+
+	log_info("Scheduler started (base period %u us, CPUs %*pbl)\n", base_interval, cpumask_pr_args(&sched_cpus));
+	return 0;
+
+sched_failed:
+	log_err("Unable to set scheduling of the thread: %d\n", res);
+	kthread_stop(t);
+	return res;
+}
+
+static int scheduler_loop(void* data) {
+	sched_check_t* c;
+	u64 start, elapsed;
+	int q;
+
+	exec_start = current->se.sum_exec_runtime;
+	init_scan_timer(&timer, base_interval, SCHED_INTERVAL_ACCURACY);
+	while (1) {
+		// Apply new intervals or policy state, if any
+		q = !time_before(jiffies, READ_ONCE(alert_until));
+		if (atomic_xchg(&replan, 0) || q != quiet) {
+			plan_checks(q);
+			set_scan_interval(&timer, base_interval);
+			if (sched_policy == SCHED_DEADLINE && set_task_policy(current))
+				log_err("Scheduler: deadline period not updated to %u us\n", base_interval);
+			if (quiet && !q) restart_scan_timer(&timer); // Tighten immediately
+			quiet = q;
+		}
+
+		// Run all the checks due in this wake-up
+		elapsed = 0;
+		list_for_each_entry(c, &check_list, checks) {
+			if (c->countdown--) continue;
+			c->countdown = c->mult - 1;
+			start = local_clock();
+			c->check();
+			start = local_clock() - start;
+			c->time += start;
+			c->runs++;
+			elapsed += start;
+		}
+		check_time += elapsed;
+		if (elapsed > (u64)base_interval * NSEC_PER_USEC) overruns++;
+
+		wait_scan_timer(&timer);
+		if (kthread_should_stop()) return 0;
+	}
+}
+
+/*
+ * The deadline budget is given per base period, which is also the relative deadline.
+ * Set by the scheduler task on itself when the base period changes.
+ */
+static int set_task_policy(struct task_struct* t) {
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = sched_policy
+	};
+
+	switch (sched_policy) {
+	case SCHED_FIFO:
+		attr.sched_priority = sched_priority;
+		break;
+	case SCHED_DEADLINE:
+		attr.sched_period = attr.sched_deadline = (u64)base_interval * NSEC_PER_USEC;
+		attr.sched_runtime = (u64)min(sched_runtime, base_interval) * NSEC_PER_USEC;
+		break;
+	default:
+		return 0;
+	}
+	return sched_setattr_nocheck(t, &attr);
+}
+
+/*
+ * With one task for each check, each run would have needed its own wake-up.
+ * The CPU time of the scheduler task not spent into checks is the overhead of its wake-ups
+ * (timer handling, context switch accounted to the task, loop bookkeeping), which would have been paid
+ * again by each additional task.
+ */
+static void report_scheduler(u64 exec_time) {
+	sched_check_t* c;
+	unsigned long runs = 0, wakeups = timer.periods + 1;
+	u64 overhead;
+
+	list_for_each_entry(c, &check_list, checks) {
+		runs += c->runs;
+		if (c->runs) {
+			log_info("Scheduler: %s check, %lu runs every %u us, %llu ns per run\n",
+			         c->name, c->runs, c->interval, div64_u64(c->time, c->runs));
+		}
+	}
+
+	if (exec_time < check_time) exec_time = check_time;
+	overhead = div64_u64(exec_time - check_time, wakeups);
+	log_info("Scheduler: %lu wake-ups for %lu check runs, %llu ns overhead per wake-up, ~%llu us CPU time saved\n",
+	         wakeups, runs, overhead, div_u64(overhead * (runs > wakeups ? runs - wakeups : 0), NSEC_PER_USEC));
+	log_info("Scheduler: %lu overruns (checks longer than the base period)\n", overruns);
+	log_info("Scheduler: %d alerts raised\n", atomic_read(&alert_count));
+	report_scan_timer(&timer, "Scheduler");
+}
+
+void stop_scheduler(void) {
+	struct task_struct* t;
+	u64 exec_time;
+
+	spin_lock(&task_lock);
+	t = task;
+	task = NULL;
+	spin_unlock(&task_lock);
+
+	if (t) {
+		exec_time = t->se.sum_exec_runtime - exec_start;
+		kthread_stop(t);
+		report_scheduler(exec_time);
+		log_info("Scheduler stopped\n");
+	}
+}
+
+void sched_alert(void) {
+	int was_quiet = !time_before(jiffies, READ_ONCE(alert_until));
+
+	WRITE_ONCE(alert_until, jiffies + msecs_to_jiffies(READ_ONCE(alert_hold)));
+	atomic_inc(&alert_count);
+
+	// Do not wait for the end of a (long) quiet period
+	if (was_quiet) {
+		spin_lock(&task_lock);
+		if (task) wake_up_process(task);
+		spin_unlock(&task_lock);
+	}
+}
+
+void register_check(sched_check_t* c) {
+	c->runs = 0;
+	c->time = 0;
+	list_add_tail(&c->checks, &check_list);
+}
+
+void unregister_check(sched_check_t* c) {
+	list_del(&c->checks);
+}
+
+int set_check_interval(sched_check_t* c, unsigned interval) {
+	if (interval < SCHED_MIN_INTERVAL || interval > SCHED_MAX_INTERVAL)
+		return -EINVAL;
+	WRITE_ONCE(c->interval, interval);
+	atomic_set(&replan, 1); // Applied by the scheduler task
+	return 0;
+}
+
+static int set_interval_param(const char* val, const struct kernel_param* kp) {
+	unsigned interval;
+	int res;
+
+	if ( (res = kstrtouint(val, 0, &interval)) )
+		return res;
+	return set_check_interval((sched_check_t*)kp->arg, interval);
+}
+
+static int get_interval_param(char* buffer, const struct kernel_param* kp) {
+	return sprintf(buffer, "%u", READ_ONCE(((sched_check_t*)kp->arg)->interval));
+}
+
+const struct kernel_param_ops sched_interval_ops = {
+	.set = set_interval_param,
+	.get = get_interval_param
+};
+
+/*
+ * Adaptive policy parameters.
+ * A slowdown of 1 (default) disables the policy, since quiet and alert periods are the same.
+ * The policy state can be read to tune the parameters (1 when quiet, 0 during an alert).
+ */
+static int set_slowdown_param(const char* val, const struct kernel_param* kp) {
+	unsigned slowdown;
+	int res;
+
+	if ( (res = kstrtouint(val, 0, &slowdown)) )
+		return res;
+	if (slowdown < 1 || slowdown > SCHED_MAX_SLOWDOWN)
+		return -EINVAL;
+	WRITE_ONCE(quiet_slowdown, slowdown);
+	atomic_set(&replan, 1); // Applied by the scheduler task
+	return 0;
+}
+
+static const struct kernel_param_ops slowdown_ops = {
+	.set = set_slowdown_param,
+	.get = param_get_uint
+};
+
+static int get_quiet_param(char* buffer, const struct kernel_param* kp) {
+	return sprintf(buffer, "%d", !time_before(jiffies, READ_ONCE(alert_until)));
+}
+
+static const struct kernel_param_ops quiet_ops = {
+	.get = get_quiet_param
+};
+
+module_param_cb(quiet_slowdown, &slowdown_ops, &quiet_slowdown, 0644);
+MODULE_PARM_DESC(quiet_slowdown, "Interval multiplier of adaptive checks while no suspicious event occurs (1 disables)");
+module_param(alert_hold, uint, 0644);
+MODULE_PARM_DESC(alert_hold, "Time in milliseconds to keep the fast intervals after a suspicious event");
+module_param_cb(quiet, &quiet_ops, NULL, 0444);
+MODULE_PARM_DESC(quiet, "Adaptive policy state: 1 if quiet, 0 during an alert");
+module_param_named(alerts, alert_count.counter, int, 0444);
+MODULE_PARM_DESC(alerts, "Number of alerts raised by suspicious events");
+
+/*
+ * Scheduling parameters, applied when the scheduler is started.
+ * 'sched_policy' is one of "normal" (default), "fifo" or "deadline".
+ */
+static const char* const policy_names[] = {
+	[SCHED_NORMAL] = "normal",
+	[SCHED_FIFO] = "fifo",
+	[SCHED_DEADLINE] = "deadline"
+};
+
+static int set_policy_param(const char* val, const struct kernel_param* kp) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(policy_names); i++) {
+		if (policy_names[i] && sysfs_streq(val, policy_names[i])) {
+			sched_policy = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int get_policy_param(char* buffer, const struct kernel_param* kp) {
+	return sprintf(buffer, "%s", policy_names[sched_policy]);
+}
+
+static const struct kernel_param_ops policy_ops = {
+	.set = set_policy_param,
+	.get = get_policy_param
+};
+
+module_param_cb(sched_policy, &policy_ops, NULL, 0444);
+MODULE_PARM_DESC(sched_policy, "Scheduling policy of the scheduler task: normal, fifo or deadline");
+module_param(sched_priority, uint, 0444);
+MODULE_PARM_DESC(sched_priority, "Real-time priority of the scheduler task with the fifo policy");
+module_param(sched_runtime, uint, 0444);
+MODULE_PARM_DESC(sched_runtime, "CPU time in microseconds reserved to the scheduler task in each base period with the deadline policy");
+module_param(sched_cpu, int, 0444);
+MODULE_PARM_DESC(sched_cpu, "CPU the scheduler task is bound to (-1 for any)");
+module_param(housekeeping, bool, 0444);
+MODULE_PARM_DESC(housekeeping, "Keep the scheduler task off the CPU the PLC runtime is running on");
+module_param_named(missed_deadlines, timer.missed, ulong, 0444);
+MODULE_PARM_DESC(missed_deadlines, "Number of scan periods missed by the scheduler task");
+module_param(overruns, ulong, 0444);
+MODULE_PARM_DESC(overruns, "Number of wake-ups whose checks took longer than the base period");
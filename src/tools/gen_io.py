@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""
+I/O backend generator.
+
+Reads the declarative description of the I/O registers of a SoC (io_regs.desc)
+and emits the straight-line parts of its I/O backend:
+  - io_gen_defs.h: blocks, registers (care masks, policies) and the phys_io_conf object (see io_conf.h);
+  - io_gen.h: get_io_state() and check_io_state(), fully unrolled, with constant masks
+    and the right access width for each register.
+The semantic parts (how a change is classified, verified, committed or restored) are still written
+by hand in io_impl.h, which provides the change handlers called by check_io_state().
+
+Description format, one declaration per line ('#' starts a comment):
+  block <name> <physical base> <size in bytes> <tier: critical|secondary>
+  reg <name> <offset into block> <width: 16|32> <care mask> <policy: immutable|verifiable|ignored> [pins=<first pin>]
+  array <name> <offset into block> <count> <width: 16|32> <care mask> <policy: immutable|ignored>
+Registers belong to the last declared block. Verifiable registers must declare their first pin.
+An array declares <count> contiguous registers with the same layout, named <name>0, <name>1, ...
+
+Usage: gen_io.py <description> <output directory>
+"""
+
+import os
+import sys
+
+TIERS = ["critical", "secondary"]
+POLICIES = {"ignored": "IO_IGNORED", "immutable": "IO_IMMUTABLE", "verifiable": "IO_VERIFIABLE"}
+WIDTHS = {16: ("ioread16", "u16"), 32: ("ioread32", "u32")}
+
+
+class DescError(Exception):
+    pass
+
+
+def add_reg(blocks, reg):
+    if not blocks:
+        raise DescError("register outside of a block")
+    block = blocks[-1]
+    if reg["width"] not in WIDTHS:
+        raise DescError("unsupported width %d" % reg["width"])
+    if reg["policy"] not in POLICIES:
+        raise DescError("unknown policy '%s'" % reg["policy"])
+    if reg["offset"] % (reg["width"] // 8) or reg["offset"] + reg["width"] // 8 > block["size"]:
+        raise DescError("register misaligned or out of block")
+    if reg["mask"] >> reg["width"]:
+        raise DescError("care mask wider than the register")
+    if reg["policy"] == "verifiable" and reg["pin"] is None:
+        raise DescError("verifiable register without pins")
+    block["regs"].append(reg)
+
+
+def parse(path):
+    blocks = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            words = line.split("#", 1)[0].split()
+            if not words:
+                continue
+            try:
+                if words[0] == "block" and len(words) == 5:
+                    name, base, size, tier = words[1], int(words[2], 0), int(words[3], 0), words[4]
+                    if tier not in TIERS:
+                        raise DescError("unknown tier '%s'" % tier)
+                    blocks.append({"name": name, "base": base, "size": size, "tier": tier, "regs": []})
+                elif words[0] == "reg" and len(words) in (6, 7):
+                    reg = {"name": words[1], "offset": int(words[2], 0), "width": int(words[3], 0),
+                           "mask": int(words[4], 0), "policy": words[5], "pin": None}
+                    if len(words) == 7:
+                        if not words[6].startswith("pins="):
+                            raise DescError("unknown attribute '%s'" % words[6])
+                        reg["pin"] = int(words[6][5:], 0)
+                    add_reg(blocks, reg)
+                elif words[0] == "array" and len(words) == 7:
+                    if words[6] == "verifiable":
+                        raise DescError("verifiable array")
+                    offset, count, width = int(words[2], 0), int(words[3], 0), int(words[4], 0)
+                    for i in range(count):
+                        add_reg(blocks, {"name": "%s%d" % (words[1], i), "offset": offset + i * width // 8, "width": width,
+                                         "mask": int(words[5], 0), "policy": words[6], "pin": None})
+                else:
+                    raise DescError("unknown declaration")
+            except (DescError, ValueError) as e:
+                raise DescError("%s:%d: %s" % (path, lineno, e))
+    if not blocks:
+        raise DescError("%s: no blocks" % path)
+    return blocks
+
+
+def checked(reg):
+    return reg["mask"] and reg["policy"] != "ignored"
+
+
+def header(out, guard, desc):
+    out.append("/*")
+    out.append(" * Generated by tools/gen_io.py from %s, do not edit." % os.path.basename(desc))
+    out.append(" */")
+    out.append("")
+    out.append("#ifndef %s" % guard)
+    out.append("#define %s" % guard)
+    out.append("")
+
+
+def gen_defs(blocks, desc):
+    out = []
+    header(out, "__IO_GEN_DEFS_H", desc)
+    out.append("#define IO_BLOCKS            \t%d" % len(blocks))
+    for b in blocks:
+        name = b["name"].upper()
+        out.append("#define %-21s\t((void*)0x%08X)" % (name + "_BASE", b["base"]))
+        out.append("#define %-21s\t%d" % (name + "_SIZE", b["size"]))
+    out.append("#define __IO_STATE_TOTAL_SIZE\t%d" % sum(b["size"] for b in blocks))
+    out.append("")
+    for b in blocks:
+        out.append("static const io_reg_t %s_regs[] = {" % b["name"])
+        for i, r in enumerate(b["regs"]):
+            sep = "," if i < len(b["regs"]) - 1 else " "
+            out.append("\t{ 0x%03X, 0x%08X, %s, %d }%s // %s"
+                       % (r["offset"], r["mask"], POLICIES[r["policy"]], r["width"] // 8, sep, r["name"]))
+        out.append("};")
+        out.append("")
+    tables = [
+        ("const void*", "addrs", lambda b: "((void*)0x%08X)" % b["base"]),
+        ("const unsigned", "sizes", lambda b: "%d" % b["size"]),
+        ("const unsigned", "tiers", lambda b: "IO_TIER_%s" % b["tier"].upper()),
+        ("const io_reg_t* const", "regs", lambda b: "%s_regs" % b["name"]),
+        ("const unsigned", "reg_counts", lambda b: "ARRAY_SIZE(%s_regs)" % b["name"]),
+    ]
+    for ctype, name, value in tables:
+        out.append("static %s gen_io_%s[IO_BLOCKS] = {" % (ctype, name))
+        out.append(",\n".join("\t" + value(b) for b in blocks))
+        out.append("};")
+        out.append("")
+    out.append("static const io_conf_t phys_io_conf = {")
+    for _, name, _ in tables:
+        out.append("\t.%s = gen_io_%s," % (name, name))
+    out.append("\t.blocks = IO_BLOCKS,")
+    out.append("\t.size = __IO_STATE_TOTAL_SIZE")
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+    return out
+
+
+def gen_checks(blocks, desc):
+    out = []
+    header(out, "__IO_GEN_H", desc)
+
+    # State is saved block after block, each register at its own offset
+    out.append("static inline void get_io_state(volatile void** addrs, void* state) {")
+    offset = 0
+    for i, b in enumerate(blocks):
+        for r in b["regs"]:
+            read, ctype = WIDTHS[r["width"]]
+            out.append("\t*(%s*)(state + 0x%03X) = %s((volatile char*)addrs[%d] + 0x%03X); // %s"
+                       % (ctype, offset + r["offset"], read, i, r["offset"], r["name"]))
+        offset += b["size"]
+    out.append("}")
+    out.append("")
+
+    # Entries of each tier, in the same order as the scan plan compiled by the monitor
+    out.append("static inline void check_io_state(io_scan_t* plan, unsigned count) {")
+    out.append("\tu32 value, diff;")
+    out.append("")
+    out.append("\tif (!count) return;")
+    out.append("\tswitch (phys_io_conf.tiers[plan->block]) {")
+    for tier in TIERS:
+        out.append("\tcase IO_TIER_%s:" % tier.upper())
+        e = 0
+        for b in blocks:
+            if b["tier"] != tier:
+                continue
+            for r in b["regs"]:
+                if not checked(r):
+                    continue
+                read, _ = WIDTHS[r["width"]]
+                out.append("\t\tvalue = %s(plan[%d].addr); // %s" % (read, e, r["name"]))
+                out.append("\t\tdiff = (value ^ plan[%d].trusted) & 0x%08X & ~plan[%d].pending;" % (e, r["mask"], e))
+                if r["policy"] == "verifiable":
+                    out.append("\t\tif (unlikely(diff)) check_verifiable_change(&plan[%d], value, diff, %d);" % (e, r["pin"]))
+                else:
+                    out.append("\t\tif (unlikely(diff)) check_immutable_change(&plan[%d], value, diff);" % e)
+                e += 1
+        out.append("\t\tbreak;")
+    out.append("\t}")
+    out.append("}")
+    out.append("")
+    out.append("#endif")
+    return out
+
+
+def write(path, lines):
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("Usage: %s <description> <output directory>" % sys.argv[0])
+    try:
+        blocks = parse(sys.argv[1])
+    except (DescError, OSError) as e:
+        sys.exit("gen_io: %s" % e)
+    os.makedirs(sys.argv[2], exist_ok=True)
+    write(os.path.join(sys.argv[2], "io_gen_defs.h"), gen_defs(blocks, sys.argv[1]))
+    write(os.path.join(sys.argv[2], "io_gen.h"), gen_checks(blocks, sys.argv[1]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+if [ $# -ne 2 ]; then
+	echo "Usage ./adaptive.sh <slowdown> <hold>"
+	echo -e "\twhere <slowdown> is the interval multiplier while quiet (1 disables the adaptive policy)"
+	echo -e "\tand <hold> is the time in ms to keep the fast intervals after a suspicious event"
+	exit
+fi
+
+# Change adaptive policy of the running Ghostbuster
+params=/sys/module/ghostbuster/parameters
+echo $2 > $params/alert_hold && echo $1 > $params/quiet_slowdown
+if [ $? -ne 0 ]; then
+	echo "Setting Ghostbuster adaptive policy... failed!"
+	exit
+fi
+echo "Quiet: $(cat $params/quiet), alerts: $(cat $params/alerts)"
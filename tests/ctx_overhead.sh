@@ -0,0 +1,35 @@
+#!/bin/bash
+
+if [ $# -ne 1 ]; then
+	echo "Usage ./ctx_overhead.sh <round trips>"
+	echo -e "\twhere <round trips> is the number of token passes between two processes (e.g. 100000)"
+	echo -e "\tBuild Ghostbuster with and without MAP_EXIT_TRACEPOINT to compare exit notification backends"
+	exit
+fi
+
+# Clear kernel buffer
+dmesg -C
+if [ $? -eq 0 ]
+then
+	gcc -O2 -o ctxswitch ctxswitch.c || exit
+
+	# Clean environment
+	./clean.sh
+	sleep 1
+
+	# Measure without defense
+	echo "Without defense:"
+	./ctxswitch $1
+
+	# Measure with defense
+	./loader.sh 10
+	sleep 1
+	dmesg | grep "exit notification\|thread notifier"
+	echo "With defense:"
+	./ctxswitch $1
+	rmmod ghostbuster
+
+	echo "Test done!"
+else
+	echo "Must be root!"
+fi
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Context switch latency (lat_ctx-style): two processes pass a token
+// back and forth through a pair of pipes, so each round trip takes two context switches
+int main(int argc, char** argv) {
+	struct timespec start, end;
+	int ping[2], pong[2];
+	unsigned long i, n;
+	char token = 0;
+	double ns;
+	pid_t pid;
+
+	if (argc != 2) {
+		printf("Usage %s <round trips>\n", argv[0]);
+		return 1;
+	}
+	n = strtoul(argv[1], NULL, 0);
+
+	if (pipe(ping) || pipe(pong)) {
+		perror("pipe");
+		return 1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid) {
+		for (i = 0; i < n; i++) {
+			if (read(ping[0], &token, 1) != 1) exit(1);
+			if (write(pong[1], &token, 1) != 1) exit(1);
+		}
+		exit(0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		if (write(ping[1], &token, 1) != 1 || read(pong[0], &token, 1) != 1) {
+			perror("pipe");
+			return 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	waitpid(pid, NULL, 0);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("Context switch: %lu round trips, %.0f ns per switch (including pipe overhead)\n", n, ns / (2 * n));
+	return 0;
+}
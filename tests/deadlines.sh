@@ -0,0 +1,10 @@
+#!/bin/sh
+
+# Show how the scheduler task of the running Ghostbuster is keeping its period
+params=/sys/module/ghostbuster/parameters
+if [ ! -d $params ]; then
+	echo "Ghostbuster is not loaded"
+	exit
+fi
+echo "Policy: $(cat $params/sched_policy), CPU: $(cat $params/sched_cpu), housekeeping: $(cat $params/housekeeping)"
+echo "Missed periods: $(cat $params/missed_deadlines), overruns: $(cat $params/overruns)"
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/types.h>
+
+#include "../src/inc/events.h"
+
+static const char* monitors[] = { "I/O", "DR", "MAP" };
+static const char* verdicts[] = { "pending", "legitimate", "illegal" };
+
+// Follow the detection events of Ghostbuster (built with EVENT_RING), as described in events.h.
+int main(void) {
+	volatile gb_event_ring_t* ring;
+	volatile gb_event_t* records;
+	gb_event_t e;
+	unsigned tail, seq, head;
+	size_t size;
+	int fd;
+
+	fd = open("/dev/" EVENT_DEVICE, O_RDONLY);
+	if (fd < 0) {
+		perror("open event device");
+		return 1;
+	}
+	size = sizeof(gb_event_ring_t) + EVENT_RECORDS * sizeof(gb_event_t);
+	ring = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap event device");
+		return 1;
+	}
+	records = (volatile gb_event_t*)((volatile char*)ring + ring->offset);
+
+	// Only new events
+	tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	while (1) {
+		seq = __atomic_load_n(&records[tail % ring->size].seq, __ATOMIC_ACQUIRE);
+		if (seq != tail + 1) {
+			if ((int)(seq - (tail + 1)) > 0) { // Overwritten
+				head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+				printf("%u events lost\n", head - ring->size - tail);
+				tail = head - ring->size;
+			} else {
+				usleep(10000);
+			}
+			continue;
+		}
+		e = *(gb_event_t*)&records[tail % ring->size];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (records[tail % ring->size].seq != seq) continue; // Overwritten meanwhile, read again
+
+		printf("[%llu.%09llu] %s %s, CPU %u, target 0x%08llx, old 0x%08llx, new 0x%08llx, pid %d\n",
+		       e.time / 1000000000ULL, e.time % 1000000000ULL, monitors[e.monitor], verdicts[e.verdict],
+		       e.cpu, e.target, e.old_value, e.new_value, e.pid);
+		tail++;
+	}
+	return 0;
+}
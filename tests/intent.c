@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../src/inc/intent.h"
+
+#define GPIO_BASE	0x20200000 // BCM2835 pin controller
+#define PINS_PER_REG	10
+
+// Change the mode of a pin as a PLC runtime would do, optionally declaring it through the intent channel.
+// Ghostbuster must be loaded with the PID of this process (printed at startup) for the declaration to be allowed.
+int main(int argc, char** argv) {
+	volatile unsigned* gpio;
+	gb_intent_page_t* intent;
+	unsigned pin, mode, shift;
+	int declare, fd;
+
+	if (argc != 4) {
+		printf("Usage %s <pin> <mode> <declare>\n", argv[0]);
+		printf("\twhere <mode> is 0 (input) or 1 (output), and <declare> is 1 to use the intent channel\n");
+		return 1;
+	}
+	pin = strtoul(argv[1], NULL, 0);
+	mode = strtoul(argv[2], NULL, 0);
+	declare = atoi(argv[3]);
+
+	printf("PID %d, press enter when Ghostbuster is loaded...\n", getpid());
+	getchar();
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror("open /dev/mem");
+		return 1;
+	}
+	gpio = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_BASE);
+	if (gpio == MAP_FAILED) {
+		perror("mmap /dev/mem");
+		return 1;
+	}
+
+	if (declare) {
+		fd = open("/dev/" INTENT_DEVICE, O_RDWR);
+		if (fd < 0) {
+			perror("open intent channel");
+			return 1;
+		}
+		intent = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (intent == MAP_FAILED) {
+			perror("mmap intent channel");
+			return 1;
+		}
+		__atomic_add_fetch(&intent->pins[pin].seq, 1, __ATOMIC_RELEASE);
+		intent->pins[pin].mode = mode;
+		__atomic_add_fetch(&intent->pins[pin].seq, 1, __ATOMIC_RELEASE);
+	}
+
+	shift = (pin % PINS_PER_REG) * 3;
+	gpio[pin / PINS_PER_REG] = (gpio[pin / PINS_PER_REG] & ~(7 << shift)) | (mode << shift);
+	printf("Pin %u set to mode %u%s, see kernel log for the verdict\n", pin, mode, declare ? " (declared)" : "");
+	return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+if [ $# -ne 1 ]; then
+	echo "Usage ./interval.sh <interval>"
+	echo -e "\twhere <interval> is the new monitor interval in ms (e.g. 10, 5 or 2)"
+	exit
+fi
+
+# Change monitor intervals of the running Ghostbuster, effective from the next cycle
+params=/sys/module/ghostbuster/parameters
+echo ${1}000 > $params/io_interval && echo ${1}000 > $params/dr_interval
+if [ $? -ne 0 ]; then
+	echo "Setting Ghostbuster interval... failed!"
+fi
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+# Learn again the I/O usage of the PLC logic, e.g. after a logic upload.
+# Pin configuration changes are verified by observing the logic until the learning phase is completed.
+params=/sys/module/ghostbuster/parameters
+if [ $# -eq 1 ]; then
+	echo $1 > $params/learn_time
+fi
+echo 1 > $params/io_learn
+if [ $? -ne 0 ]; then
+	echo "Starting Ghostbuster learning phase... failed!"
+	exit
+fi
+echo "Learning phase started, see kernel log for the learned profile"
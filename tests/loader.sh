@@ -2,14 +2,14 @@
 
 if [ $# -ne 1 ]; then
 	echo "Usage ./loader.sh <interval>"
-	echo -e "\twhere <interval> is 10, 5 or 2 (ms)"
+	echo -e "\twhere <interval> is the monitor interval in ms (e.g. 10, 5 or 2)"
 	exit
 fi
 
 ppid=`pidof codesyscontrol.bin | cut -d' ' -f 1`
 vaddr=`cat /proc/$ppid/maps | grep /dev/mem | cut -d'-' -f 1 | cut -d' ' -f 1`
 
-insmod ghostbuster${1}.ko p_pid=$ppid vaddr_base=0x$vaddr
+insmod ghostbuster.ko p_pid=$ppid vaddr_base=0x$vaddr io_interval=${1}000 dr_interval=${1}000
 if [ $? -ne 0 ]; then
 	echo "Loading Ghostbuster... failed!"
 fi
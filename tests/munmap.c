@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PAGES	4 // Pages of each mapping
+
+static double elapsed_ns(struct timespec* start, struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Throughput of munmap and mremap requests not related to '/dev/mem',
+// which are hooked by the MAP monitor anyway
+int main(int argc, char** argv) {
+	struct timespec start, end;
+	double mmap_ns = 0, munmap_ns = 0, mremap_ns = 0;
+	size_t len = PAGES * sysconf(_SC_PAGESIZE);
+	unsigned long i, n;
+	void *p, *q;
+
+	if (argc != 2) {
+		printf("Usage %s <iterations>\n", argv[0]);
+		return 1;
+	}
+	n = strtoul(argv[1], NULL, 0);
+
+	for (i = 0; i < n; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		mmap_ns += elapsed_ns(&start, &end);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		q = mremap(p, len, len / 2, 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (q == MAP_FAILED) {
+			perror("mremap");
+			return 1;
+		}
+		mremap_ns += elapsed_ns(&start, &end);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		munmap(q, len / 2);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		munmap_ns += elapsed_ns(&start, &end);
+	}
+
+	printf("Map: %lu iterations, mmap %.0f ns, mremap %.0f ns, munmap %.0f ns (average)\n",
+	       n, mmap_ns / n, mremap_ns / n, munmap_ns / n);
+	return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+if [ $# -ne 1 ]; then
+	echo "Usage ./munmap_overhead.sh <iterations>"
+	echo -e "\twhere <iterations> is the number of mmap/mremap/munmap requests of each run (e.g. 100000)"
+	exit
+fi
+
+# Clear kernel buffer
+dmesg -C
+if [ $? -eq 0 ]
+then
+	gcc -O2 -o munmap munmap.c || exit
+
+	# Clean environment
+	./clean.sh
+	sleep 1
+
+	# Measure without defense
+	echo "Without defense:"
+	./munmap $1
+
+	# Measure with defense, no process mapping '/dev/mem'
+	./loader.sh 10
+	sleep 1
+	echo "With defense:"
+	./munmap $1
+	rmmod ghostbuster
+
+	echo "Test done!"
+else
+	echo "Must be root!"
+fi
@@ -23,22 +23,20 @@ then
 	insmod perf.ko
 	sleep 6
 	rmmod perf
-	rmmod ghostbuster
 	sleep 2
 
-	# Load defense with t = 5
-	./loader.sh 5
+	# Tune defense to t = 5
+	./interval.sh 5
 	sleep 2
 
 	# Measure with defense
 	insmod perf.ko
 	sleep 6
 	rmmod perf
-	rmmod ghostbuster
 	sleep 2
 
-	# Load defense with t = 2
-	./loader.sh 2
+	# Tune defense to t = 2
+	./interval.sh 2
 	sleep 2
 
 	# Measure with defense
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+make ARCH=arm CROSS_COMPILE=arm-cortexa8-linux-gnueabihf-
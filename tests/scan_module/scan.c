@@ -0,0 +1,107 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <asm/io.h>
+
+/*
+ * Compare the cost of a single I/O scan with the per-pin detection loop
+ * and with the word-level XOR detection loop used by Ghostbuster.
+ * Registers are emulated in kernel memory, with the BCM2835 layout
+ * (10 pins per register, 3 control bits per pin), and they never change:
+ * this is the normal case the monitor has to deal with on each scan.
+ */
+
+#define PINS_PER_REG        	10
+#define CTRL_BITS_PER_PIN   	3
+#define PIN_CTRL_MASK(p)    	(0x07 << ((p) * CTRL_BITS_PER_PIN))
+#define REG_CTRL_MASK       	((1 << (PINS_PER_REG * CTRL_BITS_PER_PIN)) - 1)
+
+#define MAX_REGS            	192 // Registers scanned in the largest run
+#define SCANS               	1000 // Scans for each measurement
+#define WARMUP_SCANS        	10 // Skip first scans to avoid cache-related overheads
+
+#define PMCR_VAL_NODIV      	0x00000005 // Reset and Enable Cycle Counter Register. No divider (count each cycle).
+
+static const unsigned reg_counts[] = { 6, 12, 24, 48, 96, 192 };
+
+static u32* regs;
+static u32* trusted;
+static volatile unsigned detected; // Avoid detection loops to be optimized out
+
+static noinline void scan_per_pin(unsigned count) {
+	unsigned r, p;
+	u32 value;
+
+	for (r = 0; r < count; r++) {
+		value = ioread32(regs + r);
+		for (p = 0; p < PINS_PER_REG; p++) {
+			if ((value ^ trusted[r]) & PIN_CTRL_MASK(p))
+				detected++;
+		}
+	}
+}
+
+static noinline void scan_per_word(unsigned count) {
+	unsigned r, p;
+	u32 diff;
+
+	for (r = 0; r < count; r++) {
+		diff = (ioread32(regs + r) ^ trusted[r]) & REG_CTRL_MASK;
+		if (likely(!diff)) continue;
+		do {
+			p = __ffs(diff) / CTRL_BITS_PER_PIN;
+			detected++;
+			diff &= ~PIN_CTRL_MASK(p);
+		} while (diff);
+	}
+}
+
+static unsigned measure(void (*scan)(unsigned), unsigned count) {
+	unsigned i, cycles;
+
+	for (i = 0; i < WARMUP_SCANS; i++) scan(count);
+
+	// Write Performance Monitor Control Register (PMCR)
+	asm volatile("mcr p15, 0, %0, c15, c12, 0" : : "r" (PMCR_VAL_NODIV));
+	for (i = 0; i < SCANS; i++) scan(count);
+	// Read Cycle Counter Register value
+	asm volatile("mrc p15, 0, %0, c15, c12, 1" : "=r" (cycles));
+
+	return cycles / SCANS;
+}
+
+int __init init_module(void) {
+	unsigned i, per_pin, per_word;
+
+	regs = kmalloc(MAX_REGS * sizeof(u32), GFP_KERNEL);
+	trusted = kmalloc(MAX_REGS * sizeof(u32), GFP_KERNEL);
+	if (!regs || !trusted) {
+		kfree(regs);
+		kfree(trusted);
+		return -ENOMEM;
+	}
+	for (i = 0; i < MAX_REGS; i++) {
+		regs[i] = 0x01001000 + i; // Any configuration, it only needs to be stable
+		trusted[i] = regs[i];
+	}
+
+	for (i = 0; i < ARRAY_SIZE(reg_counts); i++) {
+		per_pin = measure(scan_per_pin, reg_counts[i]);
+		per_word = measure(scan_per_word, reg_counts[i]);
+		printk(KERN_INFO "Scan: %3u registers: per-pin = %6u cycles, per-word = %6u cycles\n",
+		       reg_counts[i], per_pin, per_word);
+	}
+	asm volatile("mcr p15, 0, %0, c15, c12, 0" : : "r" (0));
+
+	kfree(regs);
+	kfree(trusted);
+	return 0;
+}
+
+void __exit cleanup_module(void) {
+}
+
+MODULE_AUTHOR("tu4st");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Ghostbuster I/O Scan Benchmark");
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Clear kernel buffer
+dmesg -C
+if [ $? -eq 0 ]
+then
+
+	# Clean environment
+	./clean.sh
+	dmesg -C
+	sleep 1
+
+	# Measure per-scan cost of both detection loops
+	insmod scan.ko
+	rmmod scan
+	dmesg | grep "Scan:"
+
+	echo "Test done!"
+else
+	echo "Must be root!"
+fi
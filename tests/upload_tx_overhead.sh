@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Clear kernel buffer
+dmesg -C
+if [ $? -eq 0 ]
+then
+	params=/sys/module/ghostbuster/parameters
+
+	# Clean environment
+	./clean.sh
+	dmesg -C
+
+	# Load defense with t = 10
+	./loader.sh 10
+	sleep 5 # Give time to prepare PLC logic upload from PLC software
+	echo "Start!"
+	sleep 1 # Wait to complete 'echo' without affecting measurements
+
+	# Measure with defense, upload inside a transaction
+	insmod perf.ko
+	echo 1 > $params/io_upload
+	sleep 6 # PLC logic upload should be done here
+	echo 0 > $params/io_upload
+	while [ "$(cat $params/io_upload)" -ne 0 ]; do
+		sleep 1 # Wait for the transaction to be committed
+	done
+	rmmod perf
+	rmmod ghostbuster
+
+	echo "Test done!"
+else
+	echo "Must be root!"
+fi